@@ -22,14 +22,23 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/dfu.h>
 
+#include "boot_request.h"
+#include "instrument.h"
+#include "sched.h"
+#include "timebase.h"
+#include "trace.h"
+#include "usb_connect.h"
+
 /*
- * Duration for a power-button press to be considered a long press.
- * Units are arbitrary, but higher is longer. :)
+ * Duration for a power-button press to be considered a long press,
+ * in milliseconds.
  */
-#define LONG_PRESS_DURATION (0x10000)
+#define LONG_PRESS_DURATION_MS (300)
 
 /*
  * Memory address at which we should allow writes to begin.
@@ -45,6 +54,28 @@
 /* The page size for the TG165's STM32F103VE. */
 #define PAGE_SIZE 2048
 
+/*
+ * Vendor requests (to the device) for reading and clearing the cycle counts
+ * from instrumented code; see instrument.h. The read returns the packed
+ * statistics, or nothing if we were built without INSTRUMENT=1.
+ */
+#define VENDOR_REQUEST_INSTRUMENT_READ  0x01
+#define VENDOR_REQUEST_INSTRUMENT_RESET 0x02
+
+/*
+ * Vendor request (to the device) for how long our startup took: returns a
+ * u32 for when we turned on the pull-up, and one for when the host
+ * configured us, both in milliseconds since reset. See usb_connect.h.
+ */
+#define VENDOR_REQUEST_STARTUP_TIMES    0x03
+
+/*
+ * Vendor request (to the device) for the event trace, including what came
+ * before our last reset: the newest records that fit, oldest first, each
+ * as a struct trace_record. See trace.h.
+ */
+#define VENDOR_REQUEST_TRACE_READ       0x04
+
 /* Commands sent with wBlockNum == 0 as per ST implementation. */
 #define CMD_SETADDR 0x21
 #define CMD_ERASE   0x41
@@ -52,7 +83,20 @@
 /* We need a special large control buffer for this device: */
 uint8_t usbd_control_buffer[1024];
 
-static enum dfu_state usbdfu_state = STATE_DFU_IDLE;
+static usbd_device *usbdev;
+
+static volatile enum dfu_state usbdfu_state = STATE_DFU_IDLE;
+
+/*
+ * Set by the USB interrupt when a downloaded block is ready to be written;
+ * the main loop does the erase or programming, which takes tens of
+ * milliseconds, and clears it.
+ */
+static volatile bool flash_work_pending;
+
+INSTRUMENT_REGION(usbd_poll);
+INSTRUMENT_REGION(flash_erase_page);
+INSTRUMENT_REGION(flash_program_block);
 
 static struct {
     uint8_t buf[sizeof(usbd_control_buffer)];
@@ -139,6 +183,10 @@ static uint8_t usbdfu_getstatus(uint32_t *bwPollTimeout)
         usbdfu_state = STATE_DFU_DNBUSY;
         *bwPollTimeout = 100;
         return DFU_STATUS_OK;
+    case STATE_DFU_DNBUSY:
+        /* Still writing; the host should check back shortly. */
+        *bwPollTimeout = 10;
+        return DFU_STATUS_OK;
     case STATE_DFU_MANIFEST_SYNC:
         /* Device will reset when read is complete. */
         usbdfu_state = STATE_DFU_MANIFEST;
@@ -148,49 +196,69 @@ static uint8_t usbdfu_getstatus(uint32_t *bwPollTimeout)
     }
 }
 
-static void usbdfu_getstatus_complete(usbd_device *usbd_dev, struct usb_setup_data *req)
+/*
+ * Erases or programs flash as the last downloaded block asks. Runs from the
+ * main loop, so the USB interrupt isn't held up -- and with it, everything
+ * at or below its priority, including the tick -- for the tens of
+ * milliseconds this takes.
+ */
+static void usbdfu_write_flash(void)
 {
     int i;
-    (void)req;
-    (void)usbd_dev;
 
-    switch (usbdfu_state) {
-    case STATE_DFU_DNBUSY:
-        flash_unlock();
-        if (prog.blocknum == 0) {
-            switch (prog.buf[0]) {
-            case CMD_ERASE:
-                {
-                    uint32_t *dat = (uint32_t *)(prog.buf + 1);
-
-                    if(*dat >= DISALLOW_WRITES_BEFORE) {
-                        flash_erase_page(*dat);
-                    }
-                }
-            case CMD_SETADDR:
-                {
-                    uint32_t *dat = (uint32_t *)(prog.buf + 1);
-                    prog.addr = *dat;
+    flash_unlock();
+    if (prog.blocknum == 0) {
+        switch (prog.buf[0]) {
+        case CMD_ERASE:
+            {
+                uint32_t *dat = (uint32_t *)(prog.buf + 1);
+
+                if(*dat >= DISALLOW_WRITES_BEFORE) {
+                    trace(TRACE_FLASH_ERASE, *dat, 0);
+                    INSTRUMENT_BEGIN(flash_erase_page);
+                    flash_erase_page(*dat);
+                    INSTRUMENT_END(flash_erase_page);
                 }
             }
-        } else {
-            uint32_t baseaddr = prog.addr + ((prog.blocknum - 2) *
-                       dfu_function.wTransferSize);
-            for (i = 0; i < prog.len; i += 2) {
-                uint16_t *dat = (uint16_t *)(prog.buf + i);
+        case CMD_SETADDR:
+            {
+                uint32_t *dat = (uint32_t *)(prog.buf + 1);
+                prog.addr = *dat;
+            }
+        }
+    } else {
+        uint32_t baseaddr = prog.addr + ((prog.blocknum - 2) *
+                   dfu_function.wTransferSize);
 
-                if(baseaddr + i >= DISALLOW_WRITES_BEFORE) {
-                    flash_program_half_word(baseaddr + i, *dat);
-                }
+        trace(TRACE_FLASH_PROGRAM, baseaddr, prog.len);
+        INSTRUMENT_BEGIN(flash_program_block);
+        for (i = 0; i < prog.len; i += 2) {
+            uint16_t *dat = (uint16_t *)(prog.buf + i);
+
+            if(baseaddr + i >= DISALLOW_WRITES_BEFORE) {
+                flash_program_half_word(baseaddr + i, *dat);
             }
         }
-        flash_lock();
+        INSTRUMENT_END(flash_program_block);
+    }
+    flash_lock();
+}
+
+static void usbdfu_getstatus_complete(usbd_device *usbd_dev, struct usb_setup_data *req)
+{
+    (void)req;
+    (void)usbd_dev;
 
-        /* Jump straight to dfuDNLOAD-IDLE, skipping dfuDNLOAD-SYNC. */
-        usbdfu_state = STATE_DFU_DNLOAD_IDLE;
+    switch (usbdfu_state) {
+    case STATE_DFU_DNBUSY:
+        /* Hand the block to the main loop; the host polls us until it's
+         * written. */
+        flash_work_pending = true;
         return;
     case STATE_DFU_MANIFEST:
-        /* USB device must detach, we just reset... */
+        /* USB device must detach, we just reset... and, with no boot request,
+         * the boot selector runs the FLIR firmware unless OK is held. */
+        trace(TRACE_RESET, TRACE_RESET_MANIFEST, 0);
         scb_reset_system();
         return; /* Will never return. */
     default:
@@ -198,6 +266,16 @@ static void usbdfu_getstatus_complete(usbd_device *usbd_dev, struct usb_setup_da
     }
 }
 
+static void usbdfu_detach_complete(usbd_device *usbd_dev, struct usb_setup_data *req)
+{
+    (void)req;
+    (void)usbd_dev;
+
+    /* Leave DFU mode for the alternate firmware, now the host has its answer. */
+    trace(TRACE_RESET, TRACE_RESET_DETACH, BOOT_REQUEST_ALT_FIRMWARE);
+    boot_request_reset(BOOT_REQUEST_ALT_FIRMWARE);
+}
+
 static int usbdfu_control_request(usbd_device *usbd_dev, struct usb_setup_data *req, uint8_t **buf,
         uint16_t *len, void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req))
 {
@@ -207,6 +285,9 @@ static int usbdfu_control_request(usbd_device *usbd_dev, struct usb_setup_data *
         return 0; /* Only accept class request. */
 
     switch (req->bRequest) {
+    case DFU_DETACH:
+        *complete = usbdfu_detach_complete;
+        return 1;
     case DFU_DNLOAD:
         if ((len == NULL) || (*len == 0)) {
             usbdfu_state = STATE_DFU_MANIFEST_SYNC;
@@ -253,26 +334,57 @@ static int usbdfu_control_request(usbd_device *usbd_dev, struct usb_setup_data *
     return 0;
 }
 
+static int usbdfu_vendor_request(usbd_device *usbd_dev, struct usb_setup_data *req, uint8_t **buf,
+        uint16_t *len, void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req))
+{
+    (void)usbd_dev;
+    (void)complete;
+
+    switch (req->bRequest) {
+    case VENDOR_REQUEST_INSTRUMENT_READ:
+        /* The host can ask for more than our control buffer holds. */
+        if (*len > sizeof(usbd_control_buffer))
+            *len = sizeof(usbd_control_buffer);
+
+        *len = instrument_serialize(*buf, *len);
+        return 1;
+    case VENDOR_REQUEST_INSTRUMENT_RESET:
+        instrument_reset();
+        return 1;
+    case VENDOR_REQUEST_STARTUP_TIMES: {
+        const struct usb_connect_times *times = usb_connect_get_times();
+
+        if (*len < 8)
+            return 0;
+
+        memcpy(*buf, &times->pullup_ms, 4);
+        memcpy(*buf + 4, &times->configured_ms, 4);
+        *len = 8;
+        return 1;
+        }
+    case VENDOR_REQUEST_TRACE_READ:
+        *len = trace_read(*buf, *len / sizeof(struct trace_record)) * sizeof(struct trace_record);
+        return 1;
+    }
+
+    return 0;
+}
+
 static void usbdfu_set_config(usbd_device *usbd_dev, uint16_t wValue)
 {
-    (void)wValue;
+    usb_connect_configured();
+    trace(TRACE_USB_CONFIGURED, wValue, 0);
 
     usbd_register_control_callback(
                 usbd_dev,
                 USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
                 USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
                 usbdfu_control_request);
-}
-
-static void setup_gpio(void)
-{
-    // Enable the clocks for every GPIO port, as we'll use them all during
-    // readback. Don't set up any GPIO beyond that.
-    rcc_periph_clock_enable(RCC_GPIOE);
-
-    /// Start with the USB pull-up disabled, so we don't trigger a connection until we're ready.
-    gpio_set(GPIOE, GPIO0);
-    gpio_set_mode(GPIOE, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, GPIO0);
+    usbd_register_control_callback(
+                usbd_dev,
+                USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_DEVICE,
+                USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+                usbdfu_vendor_request);
 }
 
 static bool power_button_pressed(void)
@@ -280,30 +392,55 @@ static bool power_button_pressed(void)
     return !gpio_get(GPIOB, GPIO1);
 }
 
+/*
+ * Resets the device once the power button has been held for a while. Runs
+ * from the tick interrupt, so it works even if the main loop is stuck.
+ */
 static void handle_long_press(void) {
-    static size_t press_duration = 0;
+    static uint32_t press_duration_ms = 0;
 
     if(power_button_pressed()) {
-        ++press_duration;
+        ++press_duration_ms;
 
-        if(press_duration > LONG_PRESS_DURATION) {
+        if(press_duration_ms > LONG_PRESS_DURATION_MS) {
+          trace(TRACE_RESET, TRACE_RESET_LONG_PRESS, 0);
           scb_reset_system();
         }
     } else {
-        press_duration = 0;
+        press_duration_ms = 0;
     }
 }
 
+/*
+ * All of our USB work happens in here, bar writing flash; see
+ * usbdfu_write_flash.
+ */
+void usb_lp_can_rx0_isr(void)
+{
+    INSTRUMENT_BEGIN(usbd_poll);
+    usbd_poll(usbdev);
+    INSTRUMENT_END(usbd_poll);
+}
+
 int main(void)
 {
-    usbd_device *usbd_dev;
+    // Start the timebase straight away, so our startup is timed from reset,
+    // and keep the USB pull-up off until we're ready for the host.
+    timebase_init();
+    usb_connect_init();
+
+    // Pick up the event trace from before the reset, and note this boot in it.
+    trace_init(TRACE_PROGRAM_DFU);
 
     // Set up use of the system's external crystal, as the 103VE series requires
     // an external crystal to drive the USB PLL.
     rcc_clock_setup_in_hse_8mhz_out_72mhz();
+    timebase_init();
 
-    // Set up our GPIO and console.
-    setup_gpio();
+    // Set up the cycle counter (if we're instrumented), and have the tick
+    // watch the power button.
+    instrument_init();
+    timebase_set_tick_handler(handle_long_press);
 
     // Enable clocking for the resources we'll be using.
     rcc_periph_clock_enable(RCC_AFIO);
@@ -313,19 +450,35 @@ int main(void)
     AFIO_MAPR |= AFIO_MAPR_SWJ_CFG_JTAG_OFF_SW_ON;
 
     // Start up our USB device controller...
-    usbd_dev = usbd_init(&st_usbfs_v1_usb_driver, &dev, &config, usb_strings, 4, usbd_control_buffer, sizeof(usbd_control_buffer));
-    usbd_register_set_config_callback(usbd_dev, usbdfu_set_config);
-
-    // Waiting a moment seems to prevent itermittent enumeration issues.
-    for (int i = 0; i < 800000; i++)
-      __asm__("nop");
+    usbdev = usbd_init(&st_usbfs_v1_usb_driver, &dev, &config, usb_strings, 4, usbd_control_buffer, sizeof(usbd_control_buffer));
+    usbd_register_set_config_callback(usbdev, usbdfu_set_config);
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
 
-    // Finally, turn on the USB pull-up to signal that we're ready to connect.
-    gpio_clear(GPIOE, GPIO0);
+    // Finally, turn on the USB pull-up to signal that we're ready to connect,
+    // once the host has had time to see us disconnect.
+    usb_connect();
 
+    // USB is handled in its interrupt; all that's left for us is writing
+    // flash when it asks, and our timers. The tick wakes us every millisecond
+    // to check on them.
     while (1) {
-        handle_long_press();
-        usbd_poll(usbd_dev);
+        if(flash_work_pending) {
+            usbdfu_write_flash();
+
+            // Jump straight to dfuDNLOAD-IDLE, skipping dfuDNLOAD-SYNC; in one
+            // go, so a status request can't see us busy with nothing to do.
+            cm_mask_interrupts(1);
+            flash_work_pending = false;
+            usbdfu_state = STATE_DFU_DNLOAD_IDLE;
+            cm_mask_interrupts(0);
+        }
+
+        sched_run();
+
+        cm_mask_interrupts(1);
+        if(sched_idle() && !flash_work_pending)
+            __asm__("wfi");
+        cm_mask_interrupts(0);
     }
 
 }
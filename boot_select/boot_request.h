@@ -0,0 +1,72 @@
+/*
+ * Software boot requests for the TG165 boot selector.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BOOT_REQUEST_H__
+#define __BOOT_REQUEST_H__
+
+/*
+ * Lets a running program choose what the boot selector starts next, without
+ * anyone holding buttons through the reset. The program leaves a request in
+ * a backup register -- which, unlike RAM, is sure to survive the FLIR
+ * bootloader -- and resets; bootsel.S checks for a request before it looks at
+ * the buttons, and clears it so it only applies to a single boot.
+ *
+ * This header is shared by bootsel.S and the C programs it boots, so only the
+ * definitions below are visible to the assembler.
+ */
+
+// BKP_DR10. The FLIR firmware is less likely to use the last of the
+// low-density backup registers than the first.
+#define BOOT_REQUEST_REGISTER        0x40006C28
+
+// Requests; anything else is ignored, and the buttons decide as usual.
+#define BOOT_REQUEST_ALT_BOOTLOADER  0xDF11
+#define BOOT_REQUEST_ALT_FIRMWARE    0xA1F0
+
+// What it takes to reach the backup registers: their clocks (in
+// RCC_APB1ENR), and, for writes, the DBP bit in PWR_CR.
+#define BOOT_REQUEST_RCC_APB1ENR     0x4002101C
+#define BOOT_REQUEST_APB1ENR_BITS    0x18000000
+#define BOOT_REQUEST_PWR_CR          0x40007000
+#define BOOT_REQUEST_PWR_CR_DBP      0x00000100
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/cm3/scb.h>
+
+/**
+ * Leaves a request for the boot selector, and resets into it.
+ * Does not return.
+ */
+static inline void boot_request_reset(uint16_t request)
+{
+    rcc_periph_clock_enable(RCC_PWR);
+    rcc_periph_clock_enable(RCC_BKP);
+    pwr_disable_backup_domain_write_protect();
+
+    MMIO32(BOOT_REQUEST_REGISTER) = request;
+
+    scb_reset_system();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Host-side comparison of ringbuf_read/ringbuf_write against the
+ * scatter/gather ringbuf_readv/ringbuf_writev, on pipes and ttys.
+ *
+ * Each iteration drains a ring buffer whose contents straddle the
+ * wrap point into the write end of a pipe (or the master side of a
+ * pty), then refills it from the read end, again across the wrap
+ * point. The plain functions need two calls for each direction; the
+ * vectored ones need one.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ringbuf.h"
+
+#define CAPACITY        4096
+#define ITERATIONS      20000
+
+static uint8_t storage[CAPACITY + 1];
+static struct ringbuf_t rb;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Place 'used' bytes in the ring, split evenly across the wrap point. */
+static void
+place_split(size_t used)
+{
+    size_t size = ringbuf_buffer_size(&rb);
+    rb.tail = rb.buf + size - used / 2;
+    rb.head = rb.buf + (size - used / 2 + used) % size;
+}
+
+/* Place an empty ring whose free space wraps 'len / 2' bytes in. */
+static void
+place_empty_split(size_t len)
+{
+    size_t size = ringbuf_buffer_size(&rb);
+    rb.head = rb.tail = rb.buf + size - len / 2;
+}
+
+/*
+ * Move 'len' bytes out through wfd and back in through rfd, using
+ * either the plain or the vectored functions. Returns the number of
+ * syscalls made, or -1 on error.
+ */
+static long
+round_trip(int rfd, int wfd, size_t len, int vectored)
+{
+    long calls = 0;
+    size_t done;
+
+    place_split(len);
+    for (done = 0; done < len; ++calls) {
+        ssize_t n = vectored ? ringbuf_writev(wfd, &rb, len - done)
+                             : ringbuf_write(wfd, &rb, len - done);
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+
+    place_empty_split(len);
+    for (done = 0; done < len; ++calls) {
+        ssize_t n = vectored ? ringbuf_readv(rfd, &rb, len - done)
+                             : ringbuf_read(rfd, &rb, len - done);
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+
+    return calls;
+}
+
+static void
+run(const char *transport, int rfd, int wfd, size_t len)
+{
+    for (int vectored = 0; vectored <= 1; ++vectored) {
+        long calls = 0;
+        double start = now_ns();
+
+        for (int i = 0; i < ITERATIONS; ++i) {
+            long n = round_trip(rfd, wfd, len, vectored);
+            if (n < 0) {
+                printf("bench=fdio transport=%s impl=%s size=%zu result=error errno=%d\n",
+                        transport, vectored ? "vectored" : "plain", len, errno);
+                return;
+            }
+            calls += n;
+        }
+
+        double elapsed = now_ns() - start;
+        printf("bench=fdio transport=%s impl=%s size=%zu iterations=%d "
+                "syscalls_per_iteration=%.2f ns_per_byte=%.3f mb_per_s=%.1f\n",
+                transport, vectored ? "vectored" : "plain", len, ITERATIONS,
+                (double)calls / ITERATIONS,
+                elapsed / ((double)ITERATIONS * len * 2),
+                (ITERATIONS * len * 2 / 1e6) / (elapsed / 1e9));
+    }
+}
+
+/* Open a raw-mode pty pair; returns -1 if ptys aren't available here. */
+static int
+open_pty(int *master, int *slave)
+{
+    struct termios tio;
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) || unlockpt(*master))
+        return -1;
+
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    if (*slave < 0)
+        return -1;
+
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    return 0;
+}
+
+int
+main(void)
+{
+    static const size_t sizes[] = { 64, 512, 2048 };
+    int pipefd[2], master, slave;
+
+    memset(storage, 'x', sizeof(storage));
+    ringbuf_init(&rb, storage, CAPACITY);
+
+    if (pipe(pipefd)) {
+        perror("pipe");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        run("pipe", pipefd[0], pipefd[1], sizes[i]);
+
+    /* A pty only buffers a few KiB, so keep to the smaller sizes. */
+    if (open_pty(&master, &slave)) {
+        printf("bench=fdio transport=tty result=skipped\n");
+        return 0;
+    }
+    for (size_t i = 0; i < 2; ++i)
+        run("tty", slave, master, sizes[i]);
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Host-side benchmark for the Intel HEX record encoder.
+ *
+ * Formats 64 KiB of data into a ringbuf_spsc_t, the way the 'd' command
+ * feeds the console, two ways: one character at a time with a room check
+ * for each (as the original dump_line did), and a page of records at a
+ * time with ihex_encode_data and a single copy into the ring. Both must
+ * produce identical output.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ihex.h"
+#include "ringbuf_spsc.h"
+
+#define DUMP_SIZE       0x10000
+#define LINE_SIZE       16
+#define LINES_PER_PAGE  16
+#define PASSES          50
+
+/* Big enough to hold a whole page of records, like the console's ring. */
+#define STORAGE_SIZE    4096
+
+static uint8_t source[DUMP_SIZE];
+static uint8_t storage[STORAGE_SIZE];
+static struct ringbuf_spsc_t rb;
+
+/* Everything drained from the ring, for comparing the two encoders. */
+static uint8_t output[2][DUMP_SIZE * 3];
+static size_t output_len[2];
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Empty the ring, as the USB endpoint would. */
+static void
+drain(int which)
+{
+    output_len[which] += ringbuf_spsc_memcpy_from(output[which] + output_len[which],
+            &rb, ringbuf_spsc_bytes_used(&rb));
+}
+
+/* The original per-character path: every character checks for room. */
+#define HEX_CHAR(x) ((((x) + '0') > '9') ? ((x) + '7') : ((x) + '0'))
+
+static void
+putc_ring(char c)
+{
+    void *span;
+
+    while (ringbuf_spsc_reserve(&rb, &span) == 0)
+        drain(0);
+
+    *(char *)span = c;
+    ringbuf_spsc_commit(&rb, 1);
+}
+
+static void
+puts_ring(const char *str)
+{
+    while (*str)
+        putc_ring(*str++);
+}
+
+static void
+dump_byte(uint8_t b)
+{
+    putc_ring(HEX_CHAR((b >> 4) & 0xf));
+    putc_ring(HEX_CHAR(b & 0xf));
+}
+
+static void
+dump_line_putc(uint32_t offset)
+{
+    uint8_t checksum = LINE_SIZE + (offset >> 8) + (offset & 0xFF);
+
+    puts_ring(":10");
+    dump_byte(offset >> 8);
+    dump_byte(offset & 0xFF);
+    puts_ring("00");
+    for (int i = 0; i < LINE_SIZE; ++i) {
+        dump_byte(source[offset + i]);
+        checksum += source[offset + i];
+    }
+    dump_byte(~checksum + 1);
+    puts_ring("\r\n");
+}
+
+static void
+dump_putc(void)
+{
+    for (uint32_t offset = 0; offset < DUMP_SIZE; offset += LINE_SIZE)
+        dump_line_putc(offset);
+    puts_ring(IHEX_EOF_RECORD);
+    drain(0);
+}
+
+/* The batched path: format a page locally, then copy it in once. */
+static void
+dump_batched(void)
+{
+    static char page[LINES_PER_PAGE * IHEX_MAX_ENCODED_SIZE];
+    uint16_t upper = 0;
+
+    for (uint32_t offset = 0; offset < DUMP_SIZE; ) {
+        size_t page_len = 0;
+
+        for (int i = 0; i < LINES_PER_PAGE && offset < DUMP_SIZE; ++i) {
+            page_len += ihex_encode_data(&page[page_len], offset,
+                    &source[offset], LINE_SIZE, &upper);
+            offset += LINE_SIZE;
+        }
+
+        if (ringbuf_spsc_bytes_free(&rb) < page_len)
+            drain(1);
+        ringbuf_spsc_memcpy_into(&rb, page, page_len);
+    }
+
+    ringbuf_spsc_memcpy_into(&rb, IHEX_EOF_RECORD, strlen(IHEX_EOF_RECORD));
+    drain(1);
+}
+
+static void
+run(const char *impl, int which, void (*dump)(void))
+{
+    double start = now_ns();
+
+    for (int i = 0; i < PASSES; ++i) {
+        output_len[which] = 0;
+        dump();
+    }
+
+    double elapsed = now_ns() - start;
+    printf("bench=ihex impl=%s source_bytes=%d hex_bytes=%zu ns_per_source_byte=%.3f "
+            "source_mb_per_s=%.1f\n",
+            impl, DUMP_SIZE, output_len[which], elapsed / ((double)PASSES * DUMP_SIZE),
+            (PASSES * (double)DUMP_SIZE / 1e6) / (elapsed / 1e9));
+}
+
+int
+main(void)
+{
+    srand(1);
+    for (size_t i = 0; i < sizeof(source); ++i)
+        source[i] = (uint8_t)rand();
+
+    ringbuf_spsc_init(&rb, storage, sizeof(storage));
+
+    run("putc", 0, dump_putc);
+    run("batched", 1, dump_batched);
+
+    if (output_len[0] != output_len[1] || memcmp(output[0], output[1], output_len[0])) {
+        printf("bench=ihex result=mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Host-side benchmark for the compressed binary dump codec.
+ *
+ * Compresses a flash image 512 bytes at a time, the way the 'b ... z'
+ * command does, and reports how many bytes a full readout puts on the wire
+ * with and without compression, along with the compressor's cost per byte.
+ * Every block is decompressed again and checked against the original.
+ *
+ * By default, the image is a synthetic one shaped like the TG165's flash:
+ * code and literal pools up front, zero-padded tables, and erased (0xFF)
+ * space after. A real image can be given as the only argument instead.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lz.h"
+
+#define FLASH_SIZE      (512 * 1024)
+#define BLOCK_SIZE      512
+#define PASSES          20
+
+/* Header and trailer bytes around each binary dump frame; see bindump.h. */
+#define FRAME_OVERHEAD  16
+
+static uint8_t image[FLASH_SIZE];
+static size_t image_len;
+
+static uint8_t packed[BLOCK_SIZE];
+static uint8_t unpacked[BLOCK_SIZE];
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The reference decompressor, for checking the compressor's output. */
+static size_t
+decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity)
+{
+    size_t in = 0, out = 0;
+
+    while (in < len) {
+        uint8_t token = src[in++];
+
+        if (token < 0x80) {
+            size_t count = token + 1;
+            if (in + count > len || out + count > capacity)
+                return 0;
+            memcpy(dst + out, src + in, count);
+            in += count;
+            out += count;
+        } else {
+            size_t count = token - 0x80 + LZ_MIN_MATCH;
+            size_t distance;
+
+            if (in + 2 > len)
+                return 0;
+            distance = src[in] | (src[in + 1] << 8);
+            in += 2;
+            if (!distance || distance > out || out + count > capacity)
+                return 0;
+            for (size_t i = 0; i < count; ++i, ++out)
+                dst[out] = dst[out - distance];
+        }
+    }
+
+    return out;
+}
+
+/*
+ * Build an image shaped like real firmware: instructions (a small
+ * vocabulary of opcodes with varying operands), literal pools of
+ * repeated addresses, zero-padded tables, then erased flash.
+ */
+static void
+synthesize(void)
+{
+    static const uint16_t opcodes[] = {
+        0x4770, 0xb510, 0xbd10, 0x6800, 0x6008, 0x2000, 0xf7ff, 0x4618,
+        0x3001, 0x2800, 0xd1fa, 0x4b02, 0x681b, 0xe7fe, 0xb580, 0xbd80,
+    };
+    size_t pos = 0;
+
+    srand(1);
+
+    while (pos < 96 * 1024) {
+        /* A function's worth of code... */
+        for (int i = rand() % 64 + 16; i > 0; --i, pos += 2) {
+            uint16_t op = opcodes[rand() % 16];
+            if (rand() % 4 == 0)
+                op ^= rand() & 0xFF;
+            image[pos] = op;
+            image[pos + 1] = op >> 8;
+        }
+
+        /* ... followed by its literal pool. */
+        for (int i = rand() % 6; i > 0; --i, pos += 4) {
+            uint32_t literal = (rand() % 2 ? 0x08000000 : 0x20000000) + (rand() % 64) * 4;
+            memcpy(image + pos, &literal, 4);
+        }
+    }
+
+    /* Tables, mostly zeroes. */
+    for (; pos < 128 * 1024; ++pos)
+        image[pos] = (rand() % 8 == 0) ? rand() : 0;
+
+    memset(image + pos, 0xFF, FLASH_SIZE - pos);
+    image_len = FLASH_SIZE;
+}
+
+static int
+load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+        return -1;
+
+    image_len = fread(image, 1, sizeof(image), f);
+    fclose(f);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t raw_wire = 0, lz_wire = 0;
+    double start, elapsed;
+
+    if (argc > 1) {
+        if (load(argv[1])) {
+            perror(argv[1]);
+            return 1;
+        }
+    } else {
+        synthesize();
+    }
+
+    /* Check every block round-trips, and total up the wire bytes. */
+    for (size_t pos = 0; pos < image_len; pos += BLOCK_SIZE) {
+        size_t len = (image_len - pos < BLOCK_SIZE) ? image_len - pos : BLOCK_SIZE;
+        size_t n = lz_compress(image + pos, len, packed, len - 1);
+
+        raw_wire += FRAME_OVERHEAD + len;
+
+        if (!n) {
+            lz_wire += FRAME_OVERHEAD + len;
+            continue;
+        }
+
+        if (decompress(packed, n, unpacked, sizeof(unpacked)) != len ||
+                memcmp(unpacked, image + pos, len)) {
+            printf("bench=lz result=mismatch offset=%zu\n", pos);
+            return 1;
+        }
+        lz_wire += FRAME_OVERHEAD + n;
+    }
+
+    start = now_ns();
+    for (int pass = 0; pass < PASSES; ++pass)
+        for (size_t pos = 0; pos < image_len; pos += BLOCK_SIZE) {
+            size_t len = (image_len - pos < BLOCK_SIZE) ? image_len - pos : BLOCK_SIZE;
+            lz_compress(image + pos, len, packed, len - 1);
+        }
+    elapsed = now_ns() - start;
+
+    printf("bench=lz image=%s bytes=%zu raw_wire_bytes=%zu lz_wire_bytes=%zu ratio=%.2f ns_per_byte=%.3f\n",
+            argc > 1 ? argv[1] : "synthetic", image_len, raw_wire, lz_wire,
+            (double)raw_wire / lz_wire, elapsed / ((double)PASSES * image_len));
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Host-side comparison of the ways our ring buffers turn indices into
+ * buffer offsets, on the console's hot path.
+ *
+ * Three implementations stream the same data: ringbuf_t, which wraps
+ * with a modulo by its size; the offset-and-compare scheme ringbuf_spsc
+ * used before it moved to free-running counters, reproduced below; and
+ * ringbuf_spsc itself, which masks its counters. Data is written a few
+ * bytes at a time and read back a packet at a time, as the console
+ * does.
+ *
+ * Measures cycles per byte (time-stamp counter cycles on x86, or
+ * nanoseconds elsewhere). These are host cycles, not the Cortex-M3's;
+ * for those, build the extractor with INSTRUMENT=1 and compare its
+ * console_ring_write region.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "ringbuf.h"
+#include "ringbuf_spsc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMER_UNIT "cycles"
+static inline uint64_t timer_now(void) { return __rdtsc(); }
+#else
+#define TIMER_UNIT "ns"
+static inline uint64_t timer_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define RING_SIZE       4096
+#define PACKET_SIZE     64
+#define TOTAL_BYTES     (16UL * 1024 * 1024)
+
+
+/*
+ * The offset-and-compare ring: head and tail are offsets into the
+ * storage, wrapped by comparing against its size, with one byte kept
+ * free to tell full from empty.
+ */
+struct offset_ring {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+};
+
+static size_t
+offset_used(const struct offset_ring *rb, size_t head, size_t tail)
+{
+    if (head >= tail)
+        return head - tail;
+    else
+        return rb->size - (tail - head);
+}
+
+static size_t
+offset_put(struct offset_ring *rb, const uint8_t *src, size_t count)
+{
+    size_t head = __atomic_load_n(&rb->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    size_t done = 0;
+
+    count = MIN(count, rb->size - 1 - offset_used(rb, head, tail));
+
+    while (done != count) {
+        size_t n = MIN(rb->size - head, count - done);
+        memcpy(rb->buf + head, src + done, n);
+        head += n;
+        done += n;
+
+        if (head == rb->size)
+            head = 0;
+    }
+
+    __atomic_store_n(&rb->head, head, __ATOMIC_RELEASE);
+    return done;
+}
+
+static size_t
+offset_get(uint8_t *dst, struct offset_ring *rb, size_t count)
+{
+    size_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&rb->tail, __ATOMIC_RELAXED);
+    size_t done = 0;
+
+    count = MIN(count, offset_used(rb, head, tail));
+
+    while (done != count) {
+        size_t n = MIN(rb->size - tail, count - done);
+        memcpy(dst + done, rb->buf + tail, n);
+        tail += n;
+        done += n;
+
+        if (tail == rb->size)
+            tail = 0;
+    }
+
+    __atomic_store_n(&rb->tail, tail, __ATOMIC_RELEASE);
+    return done;
+}
+
+
+static uint8_t ringbuf_storage[RING_SIZE + 1];
+static uint8_t offset_storage[RING_SIZE];
+static uint8_t spsc_storage[RING_SIZE];
+
+static struct ringbuf_t modulo_rb;
+static struct offset_ring offset_rb = { offset_storage, RING_SIZE, 0, 0 };
+static struct ringbuf_spsc_t spsc_rb;
+
+/* Keeps the optimizer from discarding results. */
+static volatile size_t sink;
+
+static void
+report(const char *impl, size_t chunk, uint64_t ticks)
+{
+    printf("bench=mask impl=%s chunk=%zu bytes=%lu %s_per_byte=%.3f\n",
+            impl, chunk, TOTAL_BYTES, TIMER_UNIT, (double)ticks / TOTAL_BYTES);
+}
+
+/*
+ * Stream TOTAL_BYTES through each ring, writing 'chunk' bytes at a time
+ * and reading them back a packet at a time.
+ */
+static void
+bench_stream(size_t chunk)
+{
+    uint8_t in[PACKET_SIZE], out[PACKET_SIZE];
+    uint64_t start;
+
+    memset(in, 'x', sizeof(in));
+
+    ringbuf_reset(&modulo_rb);
+    start = timer_now();
+    for (size_t done = 0; done < TOTAL_BYTES; done += chunk) {
+        ringbuf_memcpy_into(&modulo_rb, in, chunk);
+        while (ringbuf_bytes_used(&modulo_rb) >= sizeof(out))
+            ringbuf_memcpy_from(out, &modulo_rb, sizeof(out));
+    }
+    report("modulo", chunk, timer_now() - start);
+    sink = out[0];
+
+    offset_rb.head = offset_rb.tail = 0;
+    start = timer_now();
+    for (size_t done = 0; done < TOTAL_BYTES; done += chunk) {
+        offset_put(&offset_rb, in, chunk);
+        while (offset_get(out, &offset_rb, sizeof(out)) == sizeof(out))
+            ;
+    }
+    report("offset", chunk, timer_now() - start);
+    sink = out[0];
+
+    ringbuf_spsc_reset(&spsc_rb);
+    start = timer_now();
+    for (size_t done = 0; done < TOTAL_BYTES; done += chunk) {
+        ringbuf_spsc_memcpy_into(&spsc_rb, in, chunk);
+        while (ringbuf_spsc_memcpy_from(out, &spsc_rb, sizeof(out)) == sizeof(out))
+            ;
+    }
+    report("mask", chunk, timer_now() - start);
+    sink = out[0];
+}
+
+/*
+ * Sanity-check that the masked ring delivers the same bytes as the
+ * offset ring on a wrapping workload, including the counters wrapping.
+ */
+static int
+check_equivalence(void)
+{
+    uint8_t in[97], a[97], b[97];
+
+    offset_rb.head = offset_rb.tail = 0;
+    ringbuf_spsc_reset(&spsc_rb);
+    spsc_rb.head = spsc_rb.tail = (size_t)0 - 5000;
+
+    for (size_t i = 0; i < 100000; ++i) {
+        size_t n = 1 + (i * 31) % sizeof(in);
+        for (size_t j = 0; j < n; ++j)
+            in[j] = (uint8_t)(i + j);
+
+        if (ringbuf_spsc_bytes_free(&spsc_rb) >= n + 1) {
+            offset_put(&offset_rb, in, n);
+            ringbuf_spsc_memcpy_into(&spsc_rb, in, n);
+        }
+
+        size_t m = 1 + (i * 17) % sizeof(a);
+        if (offset_get(a, &offset_rb, m) != ringbuf_spsc_memcpy_from(b, &spsc_rb, m) ||
+                memcmp(a, b, m) != 0) {
+            printf("bench=mask op=check result=mismatch iteration=%zu\n", i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+main(void)
+{
+    static const size_t chunks[] = { 1, 4, 16, 45, 64 };
+
+    ringbuf_init(&modulo_rb, ringbuf_storage, RING_SIZE);
+    ringbuf_spsc_init(&spsc_rb, spsc_storage, sizeof(spsc_storage));
+
+    if (check_equivalence())
+        return 1;
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i)
+        bench_stream(chunks[i]);
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Host-side benchmark suite for ringbuf.c.
+ *
+ * Times ringbuf_memcpy_into, ringbuf_memcpy_from, ringbuf_memset,
+ * ringbuf_findchr and ringbuf_copy across a sweep of transfer sizes,
+ * wrap positions and fill levels. Before each operation the ring's
+ * head and tail are placed directly, so every iteration starts from
+ * exactly the same state.
+ *
+ * Output is one line per case, as space-separated key=value pairs:
+ *
+ *   bench=ringbuf op=<op> size=<bytes> wrap=<none|split> fill=<percent used>
+ *       iterations=<n> ns_per_byte=<float> ops_per_s=<float>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuf.h"
+
+#define CAPACITY            4096
+#define BYTES_PER_CASE      (8UL * 1024 * 1024)
+#define MIN_ITERATIONS      2000
+
+enum op {
+    OP_MEMCPY_INTO,
+    OP_MEMCPY_FROM,
+    OP_MEMSET,
+    OP_FINDCHR,
+    OP_COPY,
+};
+
+static const char *op_names[] = {
+    [OP_MEMCPY_INTO] = "memcpy_into",
+    [OP_MEMCPY_FROM] = "memcpy_from",
+    [OP_MEMSET]      = "memset",
+    [OP_FINDCHR]     = "findchr",
+    [OP_COPY]        = "copy",
+};
+
+/*
+ * Where the operation starts, relative to the end of the internal
+ * buffer: either at its start (so it never wraps), or half of 'size'
+ * bytes before its end (so it's split evenly across the wrap point).
+ */
+enum wrap {
+    WRAP_NONE,
+    WRAP_SPLIT,
+};
+
+static const char *wrap_names[] = {
+    [WRAP_NONE]  = "none",
+    [WRAP_SPLIT] = "split",
+};
+
+static const unsigned fill_levels[] = { 0, 50, 95 };
+static const size_t sizes[] = { 1, 16, 64, 256, 1024 };
+
+static uint8_t storage_a[CAPACITY + 1], storage_b[CAPACITY + 1];
+static struct ringbuf_t rb_a, rb_b;
+static uint8_t linear[CAPACITY];
+
+/* Keeps the optimizer from discarding results. */
+static volatile uintptr_t sink;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Place the ring's pointers so that the side that 'op' works from
+ * (the head for producers, the tail for consumers) starts at offset
+ * 'start', with 'used' bytes in the ring.
+ */
+static void
+place(ringbuf_t rb, int producer, size_t start, size_t used)
+{
+    size_t size = ringbuf_buffer_size(rb);
+
+    if (producer) {
+        rb->head = rb->buf + start;
+        rb->tail = rb->buf + (start + size - used) % size;
+    } else {
+        rb->tail = rb->buf + start;
+        rb->head = rb->buf + (start + used) % size;
+    }
+}
+
+/*
+ * Run one case. The fill level reported is the one actually used,
+ * which may be raised so a consumer has 'size' bytes to work with.
+ */
+static void
+run_case(enum op op, size_t size, enum wrap wrap, unsigned fill)
+{
+    size_t bufsize = ringbuf_buffer_size(&rb_a);
+    size_t start = (wrap == WRAP_NONE) ? 0 : bufsize - (size + 1) / 2;
+    size_t used = (size_t)CAPACITY * fill / 100;
+    size_t iterations = BYTES_PER_CASE / size;
+
+    if (iterations < MIN_ITERATIONS)
+        iterations = MIN_ITERATIONS;
+
+    /* Consumers need at least 'size' bytes to work with. */
+    if ((op == OP_MEMCPY_FROM || op == OP_COPY) && used < size)
+        used = size;
+
+    /* For findchr, search exactly 'size' bytes for a byte that isn't there. */
+    if (op == OP_FINDCHR)
+        used = size;
+
+    int producer = (op == OP_MEMCPY_INTO || op == OP_MEMSET);
+
+    double begin = now_ns();
+    for (size_t i = 0; i < iterations; ++i) {
+        switch (op) {
+        case OP_MEMCPY_INTO:
+            place(&rb_a, producer, start, used);
+            sink = (uintptr_t)ringbuf_memcpy_into(&rb_a, linear, size);
+            break;
+        case OP_MEMCPY_FROM:
+            place(&rb_a, producer, start, used);
+            sink = (uintptr_t)ringbuf_memcpy_from(linear, &rb_a, size);
+            break;
+        case OP_MEMSET:
+            place(&rb_a, producer, start, used);
+            sink = ringbuf_memset(&rb_a, 'x', size);
+            break;
+        case OP_FINDCHR:
+            place(&rb_a, producer, start, used);
+            sink = ringbuf_findchr(&rb_a, '\n', 0);
+            break;
+        case OP_COPY:
+            /* The source is consumed from 'start'; the destination is
+             * produced into at the same position and fill level. */
+            place(&rb_a, 0, start, used);
+            place(&rb_b, 1, start, (size_t)CAPACITY * fill / 100);
+            sink = (uintptr_t)ringbuf_copy(&rb_b, &rb_a, size);
+            break;
+        }
+    }
+    double elapsed = now_ns() - begin;
+
+    printf("bench=ringbuf op=%s size=%zu wrap=%s fill=%u iterations=%zu "
+            "ns_per_byte=%.3f ops_per_s=%.0f\n",
+            op_names[op], size, wrap_names[wrap],
+            (unsigned)((used * 100 + CAPACITY / 2) / CAPACITY), iterations,
+            elapsed / ((double)iterations * size),
+            iterations / (elapsed / 1e9));
+}
+
+int
+main(void)
+{
+    /* Fill everything with a byte findchr will never be asked for. */
+    memset(storage_a, 'x', sizeof(storage_a));
+    memset(storage_b, 'x', sizeof(storage_b));
+    memset(linear, 'x', sizeof(linear));
+
+    ringbuf_init(&rb_a, storage_a, CAPACITY);
+    ringbuf_init(&rb_b, storage_b, CAPACITY);
+
+    for (size_t o = 0; o < sizeof(op_names) / sizeof(op_names[0]); ++o)
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+            for (size_t w = 0; w < sizeof(wrap_names) / sizeof(wrap_names[0]); ++w)
+                for (size_t f = 0; f < sizeof(fill_levels) / sizeof(fill_levels[0]); ++f) {
+                    /* findchr always searches exactly 'size' bytes. */
+                    if (o == OP_FINDCHR && f > 0)
+                        continue;
+                    run_case(o, sizes[s], w, fill_levels[f]);
+                }
+
+    return 0;
+}
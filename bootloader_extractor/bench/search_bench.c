@@ -0,0 +1,169 @@
+/*
+ * Host-side benchmark for ringbuf_memmem and ringbuf_findany, against
+ * a naive byte-at-a-time scan over logical offsets.
+ *
+ * Each search covers a full ring whose contents straddle the wrap
+ * point, with the only match in the last few bytes. This file is
+ * built twice: once with the host's SIMD scanning, and once with
+ * RINGBUF_NO_SIMD, which uses the word-at-a-time scan the firmware
+ * uses.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuf.h"
+
+#if defined(__SSE2__) && !defined(RINGBUF_NO_SIMD)
+#define SCAN_IMPL "sse2"
+#else
+#define SCAN_IMPL "swar"
+#endif
+
+#define CAPACITY        4096
+#define PASSES          20000
+
+static uint8_t storage[CAPACITY + 1];
+static struct ringbuf_t rb;
+
+/* Keeps the optimizer from discarding results. */
+static volatile size_t sink;
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t
+logical_byte(size_t offset)
+{
+    return rb.buf[((rb.tail - rb.buf) + offset) % ringbuf_buffer_size(&rb)];
+}
+
+static size_t
+naive_findany(const uint8_t *set, size_t nset)
+{
+    size_t used = ringbuf_bytes_used(&rb);
+    for (size_t i = 0; i < used; ++i)
+        if (memchr(set, logical_byte(i), nset))
+            return i;
+    return used;
+}
+
+static size_t
+naive_memmem(const uint8_t *needle, size_t len)
+{
+    size_t used = ringbuf_bytes_used(&rb);
+    for (size_t i = 0; i + len <= used; ++i) {
+        size_t j = 0;
+        while (j < len && logical_byte(i + j) == needle[j])
+            ++j;
+        if (j == len)
+            return i;
+    }
+    return used;
+}
+
+/*
+ * Fill the ring (split across the wrap point) with bytes drawn from
+ * 'alphabet', then put 'match' at the very end.
+ */
+static void
+prepare(const char *alphabet, const uint8_t *match, size_t match_len)
+{
+    size_t size = ringbuf_buffer_size(&rb);
+    size_t nalpha = alphabet ? strlen(alphabet) : 0;
+
+    rb.tail = rb.buf + size / 2;
+    rb.head = rb.tail;
+    for (size_t i = 0; i < CAPACITY - match_len; ++i) {
+        uint8_t c = alphabet ? (uint8_t)alphabet[rand() % nalpha] : (uint8_t)rand();
+        ringbuf_memcpy_into(&rb, &c, 1);
+    }
+    ringbuf_memcpy_into(&rb, match, match_len);
+}
+
+static void
+report(const char *op, const char *impl, const char *pattern, double elapsed)
+{
+    printf("bench=search op=%s impl=%s pattern=%s bytes=%d ns_per_byte=%.3f\n",
+            op, impl, pattern, CAPACITY, elapsed / ((double)PASSES * CAPACITY));
+}
+
+static int
+bench_memmem(const char *pattern, const char *alphabet, const uint8_t *needle, size_t len)
+{
+    double start;
+
+    prepare(alphabet, needle, len);
+    if (ringbuf_memmem(&rb, needle, len, 0) != naive_memmem(needle, len))
+        return 1;
+
+    start = now_ns();
+    for (int i = 0; i < PASSES; ++i)
+        sink = ringbuf_memmem(&rb, needle, len, 0);
+    report("memmem", SCAN_IMPL, pattern, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < PASSES; ++i)
+        sink = naive_memmem(needle, len);
+    report("memmem", "naive", pattern, now_ns() - start);
+
+    return 0;
+}
+
+static int
+bench_findany(const char *pattern, const char *alphabet, const uint8_t *set, size_t nset)
+{
+    double start;
+
+    prepare(alphabet, set, 1);
+    if (ringbuf_findany(&rb, set, nset, 0) != naive_findany(set, nset))
+        return 1;
+
+    start = now_ns();
+    for (int i = 0; i < PASSES; ++i)
+        sink = ringbuf_findany(&rb, set, nset, 0);
+    report("findany", SCAN_IMPL, pattern, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < PASSES; ++i)
+        sink = naive_findany(set, nset);
+    report("findany", "naive", pattern, now_ns() - start);
+
+    return 0;
+}
+
+int
+main(void)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    static const uint8_t crlf[] = { '\r', '\n' };
+    static const uint8_t sync[] = { 0xA5, 0x5A, 0xC3, 0x3C };
+    static const uint8_t record[] = { ':', '\r', '\n' };
+    static const uint8_t wide[] = { ':', '\r', '\n', ';', '$', '#', '!', '@' };
+    int failed = 0;
+
+    ringbuf_init(&rb, storage, CAPACITY);
+    srand(1);
+
+    failed |= bench_memmem("crlf", hex, crlf, sizeof(crlf));
+    /* Random binary data, so the sync word's first byte shows up often. */
+    failed |= bench_memmem("sync32", NULL, sync, sizeof(sync));
+    failed |= bench_findany("record", hex, record, sizeof(record));
+    failed |= bench_findany("wide8", hex, wide, sizeof(wide));
+
+    if (failed)
+        printf("bench=search result=mismatch\n");
+
+    return failed;
+}
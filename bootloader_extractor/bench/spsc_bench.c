@@ -0,0 +1,212 @@
+/*
+ * Host-side stress test and throughput benchmark for ringbuf_spsc_t.
+ *
+ * Runs a producer thread and a consumer thread against a single ring
+ * buffer, and checks that every byte arrives exactly once and in
+ * order. The same workload is then run against the original ringbuf_t,
+ * which has to be guarded by a mutex to be shared, for comparison.
+ *
+ * Output is one line per run, as space-separated key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuf.h"
+#include "ringbuf_spsc.h"
+
+#define STORAGE_SIZE    4096
+#define TOTAL_BYTES     (16UL * 1024 * 1024)
+
+/*
+ * The byte expected at a given stream position. Multiplicative hashing
+ * means a lost, duplicated or reordered chunk is almost certain to be
+ * caught, whatever its length.
+ */
+static inline uint8_t
+pattern(uint64_t pos)
+{
+    return (uint8_t)((pos * 2654435761u) >> 24);
+}
+
+struct bench_impl {
+    const char *name;
+    size_t (*put)(void *ctx, const uint8_t *src, size_t count);
+    size_t (*get)(void *ctx, uint8_t *dst, size_t count);
+    void *ctx;
+};
+
+struct run {
+    const struct bench_impl *impl;
+    size_t chunk;
+    uint64_t errors;
+};
+
+
+/* Lock-free implementation under test. */
+static size_t
+spsc_put(void *ctx, const uint8_t *src, size_t count)
+{
+    return ringbuf_spsc_memcpy_into(ctx, src, count);
+}
+
+static size_t
+spsc_get(void *ctx, uint8_t *dst, size_t count)
+{
+    return ringbuf_spsc_memcpy_from(dst, ctx, count);
+}
+
+
+/* The original ring buffer, made thread-safe the only way it can be. */
+struct locked_ringbuf {
+    struct ringbuf_t rb;
+    pthread_mutex_t lock;
+};
+
+static size_t
+locked_put(void *ctx, const uint8_t *src, size_t count)
+{
+    struct locked_ringbuf *l = ctx;
+
+    pthread_mutex_lock(&l->lock);
+    size_t n = ringbuf_bytes_free(&l->rb);
+    if (count < n)
+        n = count;
+    ringbuf_memcpy_into(&l->rb, src, n);
+    pthread_mutex_unlock(&l->lock);
+
+    return n;
+}
+
+static size_t
+locked_get(void *ctx, uint8_t *dst, size_t count)
+{
+    struct locked_ringbuf *l = ctx;
+
+    pthread_mutex_lock(&l->lock);
+    size_t n = ringbuf_bytes_used(&l->rb);
+    if (count < n)
+        n = count;
+    ringbuf_memcpy_from(dst, &l->rb, n);
+    pthread_mutex_unlock(&l->lock);
+
+    return n;
+}
+
+
+static void *
+producer(void *arg)
+{
+    struct run *r = arg;
+    uint8_t *chunk = malloc(r->chunk);
+    uint64_t pos = 0;
+
+    while (pos < TOTAL_BYTES) {
+        size_t want = r->chunk;
+        if (want > TOTAL_BYTES - pos)
+            want = TOTAL_BYTES - pos;
+
+        for (size_t i = 0; i < want; ++i)
+            chunk[i] = pattern(pos + i);
+
+        /* If the ring is full, give the consumer a chance to run. */
+        size_t sent = 0;
+        while (sent < want) {
+            size_t n = r->impl->put(r->impl->ctx, chunk + sent, want - sent);
+            if (n == 0)
+                sched_yield();
+            sent += n;
+        }
+
+        pos += want;
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+static void *
+consumer(void *arg)
+{
+    struct run *r = arg;
+    uint8_t *chunk = malloc(r->chunk);
+    uint64_t pos = 0;
+
+    while (pos < TOTAL_BYTES) {
+        size_t n = r->impl->get(r->impl->ctx, chunk, r->chunk);
+        if (n == 0)
+            sched_yield();
+
+        for (size_t i = 0; i < n; ++i)
+            if (chunk[i] != pattern(pos + i))
+                ++r->errors;
+
+        pos += n;
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+run_one(const struct bench_impl *impl, size_t chunk)
+{
+    struct run r = { .impl = impl, .chunk = chunk, .errors = 0 };
+    pthread_t prod, cons;
+
+    double start = now_ns();
+    pthread_create(&cons, NULL, consumer, &r);
+    pthread_create(&prod, NULL, producer, &r);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    double elapsed = now_ns() - start;
+
+    printf("bench=spsc impl=%s chunk=%zu bytes=%lu ns_per_byte=%.3f mb_per_s=%.1f errors=%lu\n",
+            impl->name, chunk, TOTAL_BYTES, elapsed / TOTAL_BYTES,
+            (TOTAL_BYTES / 1e6) / (elapsed / 1e9), (unsigned long)r.errors);
+
+    return r.errors ? 1 : 0;
+}
+
+int
+main(void)
+{
+    static uint8_t spsc_storage[STORAGE_SIZE];
+    static uint8_t locked_storage[STORAGE_SIZE];
+    static const size_t chunks[] = { 1, 7, 64, 500, 4095 };
+
+    struct ringbuf_spsc_t spsc;
+    struct locked_ringbuf locked;
+
+    ringbuf_spsc_init(&spsc, spsc_storage, sizeof(spsc_storage));
+    ringbuf_init(&locked.rb, locked_storage, sizeof(locked_storage) - 1);
+    pthread_mutex_init(&locked.lock, NULL);
+
+    const struct bench_impl impls[] = {
+        { "spsc",   spsc_put,   spsc_get,   &spsc },
+        { "locked", locked_put, locked_get, &locked },
+    };
+
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+            failed |= run_one(&impls[i], chunks[c]);
+        }
+    }
+
+    return failed;
+}
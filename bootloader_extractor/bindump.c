@@ -0,0 +1,188 @@
+/*
+ * Binary framed memory dumps for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/cm3/dwt.h>
+
+#include "bindump.h"
+#include "console.h"
+#include "crc32.h"
+#include "lz.h"
+
+/**
+ * A region of the STM32F103VE's memory map that can be read without faulting.
+ */
+struct memory_region {
+    uint32_t base;
+    uint32_t size;
+};
+
+static const struct memory_region readable_regions[] = {
+    { 0x08000000, 512 * 1024 },     // main flash
+    { 0x1FFFF000, 2048 + 16 },      // system memory and option bytes
+    { 0x20000000, 64 * 1024 },      // SRAM
+};
+
+/**
+ * Where each frame is compressed before it's sent.
+ */
+static uint8_t compressed[BINDUMP_MAX_PAYLOAD];
+
+static struct bindump_stats stats;
+
+
+bool bindump_range_readable(uint32_t address, uint32_t length)
+{
+    size_t num_regions = sizeof(readable_regions) / sizeof(readable_regions[0]);
+
+    for(size_t i = 0; i < num_regions; ++i) {
+        const struct memory_region *region = &readable_regions[i];
+
+        // Written so that neither side can overflow.
+        if(address < region->base || length > region->size)
+            continue;
+        if(address - region->base > region->size - length)
+            continue;
+
+        return true;
+    }
+
+    return false;
+}
+
+static void put_le16(uint8_t *dest, uint16_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+}
+
+static void put_le32(uint8_t *dest, uint32_t value)
+{
+    put_le16(dest, value & 0xFFFF);
+    put_le16(dest + 2, value >> 16);
+}
+
+/**
+ * Queues all of data for the host; a binary frame is useless if any of it
+ * is dropped, so this always waits for room.
+ */
+static void send_all(const void *data, size_t len)
+{
+    console_write_policy(data, len, CONSOLE_BLOCK, CONSOLE_WAIT_FOREVER);
+}
+
+void bindump_send_frame(enum bindump_frame_type type, uint16_t sequence,
+        uint32_t address, const void *payload, uint16_t length)
+{
+    uint8_t header[BINDUMP_HEADER_SIZE];
+    uint8_t trailer[BINDUMP_TRAILER_SIZE];
+    uint32_t crc;
+
+    header[0] = BINDUMP_SYNC_0;
+    header[1] = BINDUMP_SYNC_1;
+    header[2] = type;
+    header[3] = 0;
+    put_le16(&header[4], sequence);
+    put_le16(&header[6], length);
+    put_le32(&header[8], address);
+
+    // The sync bytes are left out of the CRC, so the host can check a frame
+    // without caring how it found it.
+    crc = crc32_update(CRC32_INIT, &header[2], sizeof(header) - 2);
+    crc = crc32_update(crc, payload, length);
+    put_le32(trailer, crc);
+
+    // The payload goes straight from memory into the console buffer.
+    send_all(header, sizeof(header));
+    send_all(payload, length);
+    send_all(trailer, sizeof(trailer));
+}
+
+/**
+ * Sends a range as an LZ frame, or as a plain DATA frame if it doesn't
+ * compress.
+ */
+static void send_compressed(uint16_t sequence, uint32_t address, uint16_t length)
+{
+    const uint8_t *data = (const uint8_t *)(uintptr_t)address;
+    uint32_t start = dwt_read_cycle_counter();
+
+    // Only accept a result that actually saves us something.
+    size_t packed = lz_compress(data, length, compressed, length - 1);
+
+    stats.compress_cycles += dwt_read_cycle_counter() - start;
+    stats.raw_bytes += length;
+
+    if(packed) {
+        bindump_send_frame(BINDUMP_FRAME_LZ, sequence, address, compressed, packed);
+        stats.sent_bytes += packed;
+    } else {
+        bindump_send_frame(BINDUMP_FRAME_DATA, sequence, address, data, length);
+        stats.sent_bytes += length;
+    }
+}
+
+bool bindump_start(struct bindump_transfer *transfer, uint32_t address, uint32_t length,
+        bool compress)
+{
+    if(!bindump_range_readable(address, length)) {
+        bindump_send_frame(BINDUMP_FRAME_ERROR, 0, address, NULL, 0);
+        return false;
+    }
+
+    transfer->address = address;
+    transfer->remaining = length;
+    transfer->sequence = 0;
+    transfer->compress = compress;
+    transfer->finished = false;
+    return true;
+}
+
+bool bindump_step(struct bindump_transfer *transfer)
+{
+    uint16_t chunk;
+
+    if(transfer->finished)
+        return true;
+
+    // Only send a frame once it's sure to fit; that way we never wait.
+    if(console_bytes_free() < BINDUMP_MAX_FRAME_SIZE)
+        return false;
+
+    if(!transfer->remaining) {
+        bindump_send_frame(BINDUMP_FRAME_END, transfer->sequence, transfer->address, NULL, 0);
+        transfer->finished = true;
+        return true;
+    }
+
+    chunk = (transfer->remaining > BINDUMP_MAX_PAYLOAD) ? BINDUMP_MAX_PAYLOAD : transfer->remaining;
+
+    if(transfer->compress)
+        send_compressed(transfer->sequence++, transfer->address, chunk);
+    else
+        bindump_send_frame(BINDUMP_FRAME_DATA, transfer->sequence++, transfer->address,
+                (const void *)(uintptr_t)transfer->address, chunk);
+
+    transfer->address += chunk;
+    transfer->remaining -= chunk;
+    return false;
+}
+
+const struct bindump_stats *bindump_get_stats(void)
+{
+    return &stats;
+}
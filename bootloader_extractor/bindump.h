@@ -0,0 +1,149 @@
+/*
+ * Binary framed memory dumps for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BINDUMP_H__
+#define __BINDUMP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A binary dump is sent to the host as a series of frames, each laid out as
+ * follows (multi-byte fields are little-endian):
+ *
+ *   offset  size  field
+ *   0       2     sync: 0xA5, 0x5A
+ *   2       1     type: one of the BINDUMP_FRAME_* values
+ *   3       1     reserved; always zero
+ *   4       2     sequence number, counting up from zero for each request
+ *   6       2     payload length, in bytes
+ *   8       4     address of the first payload byte
+ *   12      n     payload
+ *   12+n    4     CRC-32 of everything from the type through the payload
+ *
+ * Data frames carry up to BINDUMP_MAX_PAYLOAD bytes each, and start on
+ * BINDUMP_MAX_PAYLOAD-byte boundaries relative to the requested start
+ * address. Every request ends with a single END or ERROR frame; END frames
+ * carry the address just past the dump, and the number of data frames sent
+ * as their sequence number.
+ *
+ * Compressed dumps send each data frame's range as an LZ frame instead,
+ * whenever that's smaller: its payload is the range compressed with
+ * lz_compress (see lz.h), and expands to exactly what the DATA frame would
+ * have carried.
+ *
+ * There's no acknowledgement: a host that sees a bad or missing frame simply
+ * asks for that frame's range again.
+ */
+#define BINDUMP_SYNC_0          (0xA5)
+#define BINDUMP_SYNC_1          (0x5A)
+
+#define BINDUMP_HEADER_SIZE     (12)
+#define BINDUMP_TRAILER_SIZE    (4)
+#define BINDUMP_MAX_PAYLOAD     (512)
+#define BINDUMP_MAX_FRAME_SIZE  (BINDUMP_HEADER_SIZE + BINDUMP_MAX_PAYLOAD + BINDUMP_TRAILER_SIZE)
+
+enum bindump_frame_type {
+    BINDUMP_FRAME_DATA  = 0x01,
+    BINDUMP_FRAME_END   = 0x02,
+
+    // The requested range isn't entirely readable; nothing was sent.
+    BINDUMP_FRAME_ERROR = 0x03,
+
+    BINDUMP_FRAME_LZ    = 0x04,
+
+    // Logic analyzer captures; see capture.h.
+    BINDUMP_FRAME_CAPTURE_START = 0x05,
+    BINDUMP_FRAME_SAMPLES       = 0x06,
+
+    // Statistical profiles; see profile.h.
+    BINDUMP_FRAME_PROFILE_START = 0x07,
+    BINDUMP_FRAME_PC_SAMPLES    = 0x08,
+
+    // Thermal frames; see thermal.h.
+    BINDUMP_FRAME_THERMAL_START = 0x09,
+    BINDUMP_FRAME_THERMAL_LINES = 0x0A,
+    BINDUMP_FRAME_THERMAL_END   = 0x0B,
+
+    // Deferred log records; see log.h.
+    BINDUMP_FRAME_LOG           = 0x0C,
+};
+
+/**
+ * @return True iff the entire given range lies within a single region of
+ *      memory that can safely be read (flash, system memory, or SRAM).
+ */
+bool bindump_range_readable(uint32_t address, uint32_t length);
+
+/**
+ * The state of a binary dump that's in progress.
+ */
+struct bindump_transfer {
+    uint32_t address;
+    uint32_t remaining;
+    uint16_t sequence;
+    bool compress;
+    bool finished;
+};
+
+/**
+ * Running totals for compressed dumps, so the cost of compression can be
+ * weighed against what it saves.
+ */
+struct bindump_stats {
+
+    // Data bytes covered by compressed dumps, and the payload bytes actually
+    // sent for them.
+    uint32_t raw_bytes;
+    uint32_t sent_bytes;
+
+    // CPU cycles spent compressing.
+    uint32_t compress_cycles;
+};
+
+/**
+ * Prepares to send the given range of memory to the host as a series of
+ * binary frames, compressing them if asked. Unreadable ranges are answered
+ * with a single ERROR frame.
+ *
+ * @return True iff the transfer should now be run with bindump_step.
+ */
+bool bindump_start(struct bindump_transfer *transfer, uint32_t address, uint32_t length,
+        bool compress);
+
+/**
+ * Sends the transfer's next frame, if the console has room for all of it.
+ * Never waits for the host.
+ *
+ * @return True once the transfer's END frame has been queued.
+ */
+bool bindump_step(struct bindump_transfer *transfer);
+
+/**
+ * Queues a single frame for the host, waiting for room if need be; for
+ * other streams that use the same framing.
+ */
+void bindump_send_frame(enum bindump_frame_type type, uint16_t sequence,
+        uint32_t address, const void *payload, uint16_t length);
+
+/**
+ * @return Statistics for every compressed dump so far.
+ */
+const struct bindump_stats *bindump_get_stats(void);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * GPIO logic analyzer for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "bindump.h"
+#include "capture.h"
+#include "console.h"
+
+/**
+ * The DMA's double buffer: it fills one half while we encode the other.
+ * TIM2's update event can only request DMA1 channel 2.
+ */
+#define CAPTURE_BUFFER_SAMPLES (2048)
+#define CAPTURE_HALF_SAMPLES (CAPTURE_BUFFER_SAMPLES / 2)
+#define CAPTURE_DMA_CHANNEL (DMA_CHANNEL2)
+
+static volatile uint16_t samples[CAPTURE_BUFFER_SAMPLES];
+
+/**
+ * The number of halves the DMA has filled since the capture started; only
+ * ever incremented, by the DMA interrupt.
+ */
+static volatile uint32_t halves_filled;
+
+/**
+ * Our progress through the samples: the halves we've finished sending, and
+ * how far we are into the next.
+ */
+static uint32_t halves_sent;
+static uint32_t half_position;
+
+static uint16_t capture_mask;
+static uint16_t sequence;
+
+static struct capture_stats stats;
+
+/**
+ * Where each frame is encoded before it's sent. Room for the longest
+ * possible run record is left at the end.
+ */
+#define CAPTURE_MAX_RUN_SIZE (2 + 2)
+static uint8_t frame[BINDUMP_MAX_PAYLOAD];
+
+
+void dma1_channel2_isr(void)
+{
+    // Count each half as it's filled; both may have been, if we were held off.
+    if(dma_get_interrupt_flag(DMA1, CAPTURE_DMA_CHANNEL, DMA_HTIF)) {
+        dma_clear_interrupt_flags(DMA1, CAPTURE_DMA_CHANNEL, DMA_HTIF);
+        ++halves_filled;
+    }
+    if(dma_get_interrupt_flag(DMA1, CAPTURE_DMA_CHANNEL, DMA_TCIF)) {
+        dma_clear_interrupt_flags(DMA1, CAPTURE_DMA_CHANNEL, DMA_TCIF);
+        ++halves_filled;
+    }
+}
+
+/**
+ * Sets up TIM2 to overflow as close to the given rate as it can.
+ *
+ * @return The rate it'll actually run at.
+ */
+static uint32_t setup_timer(uint32_t rate)
+{
+    // TIM2's clock is twice APB1's whenever APB1 is divided down, as it is at 72MHz.
+    uint32_t clock = rcc_apb1_frequency * 2;
+    uint32_t ticks = (clock + rate / 2) / rate;
+    uint32_t prescaler = (ticks - 1) / 0x10000;
+    uint32_t period = ticks / (prescaler + 1);
+
+    rcc_periph_clock_enable(RCC_TIM2);
+    rcc_periph_reset_pulse(RST_TIM2);
+
+    timer_set_prescaler(TIM2, prescaler);
+    timer_set_period(TIM2, period - 1);
+
+    // Have each update request a DMA transfer. UDE is a DMA enable, not an
+    // interrupt one, and libopencm3 has no call for it (its
+    // timer_set_dma_on_update_event picks when the capture/compare channels'
+    // requests fire), so set it directly.
+    TIM_DIER(TIM2) |= TIM_DIER_UDE;
+
+    return clock / ((prescaler + 1) * period);
+}
+
+static void setup_dma(uint32_t port)
+{
+    rcc_periph_clock_enable(RCC_DMA1);
+
+    dma_channel_reset(DMA1, CAPTURE_DMA_CHANNEL);
+    dma_set_peripheral_address(DMA1, CAPTURE_DMA_CHANNEL, (uint32_t)&GPIO_IDR(port));
+    dma_set_memory_address(DMA1, CAPTURE_DMA_CHANNEL, (uint32_t)samples);
+    dma_set_number_of_data(DMA1, CAPTURE_DMA_CHANNEL, CAPTURE_BUFFER_SAMPLES);
+    dma_set_read_from_peripheral(DMA1, CAPTURE_DMA_CHANNEL);
+    dma_enable_memory_increment_mode(DMA1, CAPTURE_DMA_CHANNEL);
+
+    // GPIOx_IDR is a word register, and only word accesses are supported;
+    // the DMA reads the whole word and keeps the low half, as IDR's upper
+    // half is reserved.
+    dma_set_peripheral_size(DMA1, CAPTURE_DMA_CHANNEL, DMA_CCR_PSIZE_32BIT);
+    dma_set_memory_size(DMA1, CAPTURE_DMA_CHANNEL, DMA_CCR_MSIZE_16BIT);
+    dma_enable_circular_mode(DMA1, CAPTURE_DMA_CHANNEL);
+    dma_set_priority(DMA1, CAPTURE_DMA_CHANNEL, DMA_CCR_PL_VERY_HIGH);
+    dma_enable_half_transfer_interrupt(DMA1, CAPTURE_DMA_CHANNEL);
+    dma_enable_transfer_complete_interrupt(DMA1, CAPTURE_DMA_CHANNEL);
+
+    nvic_enable_irq(NVIC_DMA1_CHANNEL2_IRQ);
+    dma_enable_channel(DMA1, CAPTURE_DMA_CHANNEL);
+}
+
+void capture_start(uint32_t port, char port_letter, uint32_t rate, uint16_t mask)
+{
+    uint8_t announcement[8];
+
+    if(rate > CAPTURE_MAX_RATE)
+        rate = CAPTURE_MAX_RATE;
+    if(rate == 0)
+        rate = 1;
+
+    memset(&stats, 0, sizeof(stats));
+    halves_filled = 0;
+    halves_sent = 0;
+    half_position = 0;
+    sequence = 0;
+    capture_mask = mask;
+
+    stats.rate = setup_timer(rate);
+    setup_dma(port);
+
+    memcpy(announcement, &stats.rate, 4);
+    memcpy(announcement + 4, &mask, 2);
+    announcement[6] = port_letter;
+    announcement[7] = 0;
+    bindump_send_frame(BINDUMP_FRAME_CAPTURE_START, sequence++, 0, announcement, sizeof(announcement));
+
+    timer_enable_counter(TIM2);
+}
+
+void capture_stop(void)
+{
+    timer_disable_counter(TIM2);
+    dma_disable_channel(DMA1, CAPTURE_DMA_CHANNEL);
+    nvic_disable_irq(NVIC_DMA1_CHANNEL2_IRQ);
+}
+
+/**
+ * Appends a run record to the frame.
+ */
+static size_t put_run(size_t pos, uint16_t value, uint32_t length)
+{
+    frame[pos++] = value & 0xFF;
+    frame[pos++] = value >> 8;
+
+    while(length >= 0x80) {
+        frame[pos++] = (length & 0x7F) | 0x80;
+        length >>= 7;
+    }
+    frame[pos++] = length;
+
+    return pos;
+}
+
+/**
+ * If the DMA has lapped us, skips ahead to the oldest half it hasn't yet
+ * started overwriting.
+ *
+ * @return True iff we had to skip anything.
+ */
+static bool catch_up(void)
+{
+    uint32_t filled = halves_filled;
+
+    // While it's filling the half after ours, the one we're in is intact.
+    if(filled - halves_sent < 2)
+        return false;
+
+    ++stats.overflows;
+    stats.samples_lost += (filled - 1 - halves_sent) * CAPTURE_HALF_SAMPLES - half_position;
+
+    halves_sent = filled - 1;
+    half_position = 0;
+    return true;
+}
+
+void capture_step(void)
+{
+    const volatile uint16_t *half;
+    uint32_t start, position, end;
+    size_t len = 0;
+
+    catch_up();
+
+    if(halves_filled == halves_sent)
+        return;
+
+    // Only encode what we're sure we can send.
+    if(console_bytes_free() < BINDUMP_MAX_FRAME_SIZE)
+        return;
+
+    start = dwt_read_cycle_counter();
+    half = &samples[(halves_sent & 1) * CAPTURE_HALF_SAMPLES];
+    position = half_position;
+
+    // Encode runs until we reach the end of the half, or the frame is full.
+    while(position < CAPTURE_HALF_SAMPLES && len <= sizeof(frame) - CAPTURE_MAX_RUN_SIZE) {
+        uint16_t value = half[position] & capture_mask;
+
+        end = position + 1;
+        while(end < CAPTURE_HALF_SAMPLES && (half[end] & capture_mask) == value)
+            ++end;
+
+        len = put_run(len, value, end - position);
+        position = end;
+    }
+
+    stats.encode_cycles += dwt_read_cycle_counter() - start;
+
+    // If the DMA came back around while we were reading, what we read may
+    // be a mix of old and new samples; drop it rather than send it.
+    if(catch_up())
+        return;
+
+    bindump_send_frame(BINDUMP_FRAME_SAMPLES, sequence++,
+            halves_sent * CAPTURE_HALF_SAMPLES + half_position, frame, len);
+
+    stats.samples_sent += position - half_position;
+    stats.bytes_sent += len;
+
+    half_position = position;
+    if(half_position == CAPTURE_HALF_SAMPLES) {
+        ++halves_sent;
+        half_position = 0;
+    }
+}
+
+const struct capture_stats *capture_get_stats(void)
+{
+    return &stats;
+}
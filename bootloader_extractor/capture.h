@@ -0,0 +1,86 @@
+/*
+ * GPIO logic analyzer for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Continuous capture of a GPIO port, for reverse-engineering buttons and
+ * peripherals. A timer paces DMA reads of the port's input register into a
+ * double buffer; each half is run-length encoded as it fills, and streamed
+ * to the host in binary dump frames (see bindump.h):
+ *
+ *   CAPTURE_START: sent once; address zero, and a payload of
+ *       u32 sample rate in Hz, u16 pin mask, u8 port letter, u8 reserved
+ *
+ *   SAMPLES: address is the index of the frame's first sample, counting
+ *       from zero at the start of the capture; the payload is a series of
+ *       runs, each a u16 port value (masked) and the number of samples it
+ *       lasted, as an unsigned LEB128 varint
+ *
+ * Multi-byte fields are little-endian. Frames cover consecutive samples
+ * unless we fall behind and the DMA overwrites samples we haven't sent; the
+ * host sees that as a jump in the sample index.
+ */
+
+// The fastest we'll try to sample. A conservative ceiling for the DMA; how
+// fast we can actually keep up depends on how busy the signals are, and is
+// best found with la_capture.py's sweep.
+#define CAPTURE_MAX_RATE (4000000)
+
+/**
+ * Running statistics for the current (or last) capture.
+ */
+struct capture_stats {
+    uint32_t rate;
+    uint32_t samples_sent;
+    uint32_t bytes_sent;
+
+    // Times we fell behind, and the samples that were lost as a result.
+    uint32_t overflows;
+    uint32_t samples_lost;
+
+    // CPU cycles spent encoding.
+    uint32_t encode_cycles;
+};
+
+/**
+ * Starts capturing the given GPIO port (e.g. GPIOB) at the closest rate to
+ * the one asked for that the timer can manage, and announces the capture
+ * to the host.
+ */
+void capture_start(uint32_t port, char port_letter, uint32_t rate, uint16_t mask);
+
+/**
+ * Encodes and sends the next frame of samples, if any are ready and the
+ * console has room for it. Never finishes on its own; the capture runs
+ * until capture_stop.
+ */
+void capture_step(void);
+
+/**
+ * Stops the timer and DMA, ending the capture.
+ */
+void capture_stop(void);
+
+const struct capture_stats *capture_get_stats(void);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * Line-based command handling for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdline.h"
+#include "console.h"
+#include "instrument.h"
+#include "ringbuf_spsc.h"
+#include "trace.h"
+
+/**
+ * Data received from the host that hasn't been looked at yet. The USB RX
+ * callback produces into this; the main loop consumes from it.
+ */
+static uint8_t raw_rx_buffer[256];
+static struct ringbuf_spsc_t rx_buffer;
+
+INSTRUMENT_REGION(cmdline_ring_write);
+
+/**
+ * Bytes counted through the receive path, so positions in what the host
+ * sends can be compared: all those the receive path's been given, and all
+ * those the main loop has taken out of the queue.
+ */
+static uint32_t rx_received;
+static uint32_t rx_consumed;
+
+/**
+ * Set when the host asks to cancel the running command; checked (and
+ * cleared) by the main loop. The position is that of the latest cancel
+ * character received.
+ */
+static volatile bool cancel_requested;
+static volatile uint32_t cancel_position;
+
+/**
+ * The span of positions the active job has asked to receive as data; cancel
+ * characters in it are part of the data, not requests.
+ */
+static uint32_t raw_start, raw_end;
+
+/**
+ * Set when a line ends with '\r', as the '\n' of a "\r\n" may follow it;
+ * cleared once the next byte has been looked at.
+ */
+static bool line_feed_may_follow;
+
+/**
+ * The line currently being received.
+ */
+static char line[CMDLINE_MAX_LENGTH + 1];
+static size_t line_length;
+static bool line_overflowed;
+
+static const struct cmdline_command *command_table;
+static size_t command_count;
+
+static cmdline_job_t active_job;
+static void (*active_job_cancel)(void);
+
+
+void cmdline_init(const struct cmdline_command *commands, size_t num_commands)
+{
+    command_table = commands;
+    command_count = num_commands;
+    ringbuf_spsc_init(&rx_buffer, raw_rx_buffer, sizeof(raw_rx_buffer));
+}
+
+size_t cmdline_receive(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+
+    INSTRUMENT_BEGIN(cmdline_ring_write);
+    len = ringbuf_spsc_memcpy_into(&rx_buffer, data, len);
+    INSTRUMENT_END(cmdline_ring_write);
+
+    // Cancel requests need to get through even while a command is hogging
+    // the main loop, so note them here; whether they're requests or just data
+    // is up to the main loop. Only bytes the queue took count: the main loop
+    // never sees the rest, so could never catch up with a cancel among them.
+    for(size_t i = len; i > 0; --i) {
+        if(bytes[i - 1] == CMDLINE_CANCEL_CHAR) {
+            cancel_position = rx_received + i - 1;
+            cancel_requested = true;
+            break;
+        }
+    }
+
+    rx_received += len;
+    return len;
+}
+
+size_t cmdline_receive_room(void)
+{
+    return ringbuf_spsc_bytes_free(&rx_buffer);
+}
+
+/**
+ * Drops the '\n' of a "\r\n" that ended the last line, if it's next;
+ * it belongs to the command, not to whatever follows.
+ *
+ * @return True iff one was dropped.
+ */
+static bool skip_line_feed(void)
+{
+    const void *next;
+
+    if(!line_feed_may_follow || !ringbuf_spsc_peek_contiguous(&rx_buffer, &next))
+        return false;
+
+    line_feed_may_follow = false;
+    if(*(const uint8_t *)next != '\n')
+        return false;
+
+    ringbuf_spsc_consume(&rx_buffer, 1);
+    ++rx_consumed;
+    return true;
+}
+
+size_t cmdline_read_raw(void *data, size_t len)
+{
+    // If the line feed arrived after the raw data was announced, the data
+    // starts after it.
+    if(skip_line_feed() && raw_start == rx_consumed - 1) {
+        ++raw_start;
+        ++raw_end;
+    }
+
+    len = ringbuf_spsc_memcpy_from(data, &rx_buffer, len);
+    rx_consumed += len;
+    return len;
+}
+
+void cmdline_expect_raw(size_t len)
+{
+    skip_line_feed();
+
+    raw_start = rx_consumed;
+    raw_end = rx_consumed + len;
+}
+
+void cmdline_start_job(cmdline_job_t job)
+{
+    cmdline_start_cancellable_job(job, NULL);
+}
+
+void cmdline_start_cancellable_job(cmdline_job_t job, void (*cancel)(void))
+{
+    active_job = job;
+    active_job_cancel = cancel;
+}
+
+bool cmdline_parse_u32(const char *arg, uint32_t *value)
+{
+    char *end;
+
+    if(!*arg)
+        return false;
+
+    *value = strtoul(arg, &end, 0);
+    return *end == '\0';
+}
+
+void cmdline_print_usage(void)
+{
+    for(size_t i = 0; i < command_count; ++i) {
+        console_puts(command_table[i].usage);
+        console_puts("\r\n");
+    }
+    console_puts("Ctrl-C: cancel the running command\r\n");
+    console_puts("\r\n");
+}
+
+/**
+ * Splits the current line into words, in place.
+ *
+ * @return The number of words found.
+ */
+static int split_line(char **argv)
+{
+    int argc = 0;
+    char *pos = line;
+
+    while(argc < CMDLINE_MAX_ARGS) {
+
+        // Skip any leading whitespace...
+        while(*pos == ' ' || *pos == '\t')
+            ++pos;
+
+        if(!*pos)
+            break;
+
+        // ... and capture the word that follows.
+        argv[argc++] = pos;
+        while(*pos && *pos != ' ' && *pos != '\t')
+            ++pos;
+
+        if(*pos)
+            *pos++ = '\0';
+    }
+
+    return argc;
+}
+
+bool cmdline_matches(const char *name, const char *word)
+{
+    while(*name && *word) {
+        char c = *word++;
+
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if(c != *name++)
+            return false;
+    }
+
+    return !*name && !*word;
+}
+
+static void run_line(void)
+{
+    char *argv[CMDLINE_MAX_ARGS];
+    int argc = split_line(argv);
+
+    // Ignore empty lines.
+    if(!argc)
+        return;
+
+    for(size_t i = 0; i < command_count; ++i) {
+        if(cmdline_matches(command_table[i].name, argv[0])) {
+            trace(TRACE_COMMAND, argv[0][0], argc);
+            command_table[i].handler(argc, argv);
+            return;
+        }
+    }
+
+    console_puts("Unknown command: ");
+    console_puts(argv[0]);
+    console_puts("\r\n");
+}
+
+/**
+ * Takes in a single received character, running the line once it's complete.
+ */
+static void handle_char(char c)
+{
+    // The second half of a "\r\n" ends nothing more.
+    if(line_feed_may_follow) {
+        line_feed_may_follow = false;
+        if(c == '\n')
+            return;
+    }
+
+    switch(c) {
+        case CMDLINE_CANCEL_CHAR:
+            line_length = 0;
+            line_overflowed = false;
+            return;
+
+        case '\r':
+        case '\n':
+            line[line_length] = '\0';
+            line_feed_may_follow = (c == '\r');
+
+            if(line_overflowed)
+                console_puts("Command too long!\r\n");
+            else
+                run_line();
+
+            line_length = 0;
+            line_overflowed = false;
+            return;
+
+        default:
+            if(line_length < CMDLINE_MAX_LENGTH)
+                line[line_length++] = c;
+            else
+                line_overflowed = true;
+            return;
+    }
+}
+
+bool cmdline_idle(void)
+{
+    return !active_job && !cancel_requested && !ringbuf_spsc_bytes_used(&rx_buffer);
+}
+
+/**
+ * Acts on the latest cancel character the host has sent.
+ */
+static void handle_cancel(void)
+{
+    uint32_t position, unread;
+
+    cancel_requested = false;
+    position = cancel_position;
+
+    // With no job running, it only clears the line being typed, which
+    // handle_char does once it gets there; but if a line before it starts a
+    // job, that's the job it cancels.
+    if(!active_job) {
+        if((int32_t)(position - rx_consumed) >= 0)
+            cancel_requested = true;
+        return;
+    }
+
+    // In the middle of data the job asked for, it's just data.
+    if((int32_t)(position - raw_start) >= 0 && (int32_t)(position - raw_end) < 0)
+        return;
+
+    if(active_job_cancel)
+        active_job_cancel();
+    active_job = NULL;
+
+    // Drop everything the job hadn't read yet, up to the cancel character,
+    // so none of its data is mistaken for commands.
+    unread = position + 1 - rx_consumed;
+    if((int32_t)unread > 0)
+        rx_consumed += ringbuf_spsc_skip(&rx_buffer, unread);
+
+    console_puts("\r\nCancelled.\r\n");
+}
+
+void cmdline_poll(void)
+{
+    uint8_t c;
+
+    if(cancel_requested)
+        handle_cancel();
+
+    if(active_job) {
+        if(active_job())
+            active_job = NULL;
+        return;
+    }
+
+    // Handle received characters until we run out, or one of them starts a job.
+    while(!active_job && ringbuf_spsc_memcpy_from(&c, &rx_buffer, 1)) {
+        ++rx_consumed;
+        handle_char(c);
+    }
+}
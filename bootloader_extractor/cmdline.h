@@ -0,0 +1,134 @@
+/*
+ * Line-based command handling for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CMDLINE_H__
+#define __CMDLINE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The longest command line we'll accept, and the most words it can have.
+#define CMDLINE_MAX_LENGTH (64)
+#define CMDLINE_MAX_ARGS (4)
+
+// Sent by the host (as Ctrl-C) to cancel the running command.
+#define CMDLINE_CANCEL_CHAR (0x03)
+
+/**
+ * A command the host can run. The command name is matched without regard
+ * to case; argv[0] is the name itself.
+ */
+struct cmdline_command {
+    const char *name;
+    const char *usage;
+    void (*handler)(int argc, char **argv);
+};
+
+/**
+ * One step of a long-running command. Each step should do a bounded amount
+ * of work, so the main loop can keep servicing the host between steps.
+ *
+ * @return True once the command has finished.
+ */
+typedef bool (*cmdline_job_t)(void);
+
+/**
+ * Sets up the command engine with the table of commands it should accept.
+ */
+void cmdline_init(const struct cmdline_command *commands, size_t num_commands);
+
+/**
+ * Accepts data received from the host. Safe to call from USB callbacks:
+ * it only queues the data (and notes any cancel request), and takes the
+ * same time regardless of what's been received.
+ *
+ * @return The number of bytes accepted; anything else was dropped, as the
+ *      queue was full.
+ */
+size_t cmdline_receive(const void *data, size_t len);
+
+/**
+ * @return The number of bytes cmdline_receive can accept right now; the
+ *      receive path should hold off the host while this is short.
+ */
+size_t cmdline_receive_room(void);
+
+/**
+ * Takes received data as-is, rather than as command lines; for jobs that
+ * consume the host's data themselves. Cancel requests are still honoured,
+ * except within data announced with cmdline_expect_raw; when one is, the
+ * data the job hadn't read up to it is discarded.
+ *
+ * @return The number of bytes read.
+ */
+size_t cmdline_read_raw(void *data, size_t len);
+
+/**
+ * Announces that the next len bytes after the current command are binary
+ * data for the job it's starting, so any cancel characters among them are
+ * read as data rather than cancelling the job. A '\n' straight after the
+ * command's '\r' is part of the command, not the data.
+ */
+void cmdline_expect_raw(size_t len);
+
+/**
+ * Does the command engine's share of the main loop: runs one step of the
+ * active job, if there is one, or otherwise handles any complete lines
+ * received from the host.
+ */
+void cmdline_poll(void);
+
+/**
+ * @return True iff cmdline_poll has nothing to do until more data arrives
+ *      from the host: no job is running, and nothing received is waiting.
+ */
+bool cmdline_idle(void);
+
+/**
+ * Makes the given job the active one; called by command handlers whose work
+ * won't finish right away. Its steps are run by cmdline_poll until it
+ * finishes or the host cancels it, and no other commands are run meanwhile.
+ */
+void cmdline_start_job(cmdline_job_t job);
+
+/**
+ * As cmdline_start_job, for jobs that have to clean up (e.g. stop hardware
+ * they started) if they're cancelled; cancel is called if they are.
+ */
+void cmdline_start_cancellable_job(cmdline_job_t job, void (*cancel)(void));
+
+/**
+ * Parses a numeric argument; accepts decimal, or hex with a 0x prefix.
+ *
+ * @return True iff the whole argument was a valid number.
+ */
+bool cmdline_parse_u32(const char *arg, uint32_t *value);
+
+/**
+ * @return True iff the given word is the given (lower-case) name, without
+ *      regard to case; for matching subcommands the way commands are matched.
+ */
+bool cmdline_matches(const char *name, const char *word);
+
+/**
+ * Prints the usage of each known command.
+ */
+void cmdline_print_usage(void);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Console output buffering for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "console.h"
+#include "instrument.h"
+#include "ringbuf_spsc.h"
+#include "timebase.h"
+
+/**
+ * Stores a buffer for console communications with the host.
+ *
+ * The main loop produces into this buffer, and the TX endpoint callback
+ * consumes from it; it's lock-free so the latter can run from an ISR.
+ */
+static uint8_t raw_buffer[4096];
+static struct ringbuf_spsc_t console_buffer;
+
+static void (*console_poll)(void);
+static void (*overwrite_handler)(size_t len);
+static struct console_stats stats;
+
+static enum console_policy default_policy = CONSOLE_BLOCK;
+static uint32_t default_timeout = CONSOLE_WAIT_FOREVER;
+
+INSTRUMENT_REGION(console_ring_write);
+
+
+void console_init(void (*poll)(void))
+{
+    console_poll = poll;
+    ringbuf_spsc_init(&console_buffer, raw_buffer, sizeof(raw_buffer));
+}
+
+void console_set_overwrite_handler(void (*handler)(size_t len))
+{
+    overwrite_handler = handler;
+}
+
+void console_set_policy(enum console_policy policy, uint32_t timeout)
+{
+    default_policy = policy;
+    default_timeout = timeout;
+}
+
+/**
+ * Discards the oldest unsent data until there's room for len bytes.
+ */
+static void make_room(size_t len)
+{
+    size_t free = ringbuf_spsc_bytes_free(&console_buffer);
+    size_t skipped;
+
+    if(free >= len)
+        return;
+
+    // Dropping data from the tail is normally the consumer's job, so keep
+    // the transmit path from running while we do it on its behalf.
+    uint32_t was_masked = cm_mask_interrupts(1);
+    skipped = ringbuf_spsc_skip(&console_buffer, len - free);
+    if(overwrite_handler)
+        overwrite_handler(skipped);
+    cm_mask_interrupts(was_masked);
+
+    stats.overwritten_bytes += skipped;
+}
+
+size_t console_write_policy(const void *data, size_t len,
+        enum console_policy policy, uint32_t timeout)
+{
+    const uint8_t *pos = data;
+    size_t queued = 0;
+    bool waiting = false;
+    uint32_t wait_start = 0;
+
+    if(policy == CONSOLE_OVERWRITE_OLDEST) {
+        size_t capacity = ringbuf_spsc_capacity(&console_buffer);
+
+        // If this write can't fit even in an empty buffer, its own oldest
+        // bytes are the first to go.
+        if(len > capacity) {
+            stats.overwritten_bytes += len - capacity;
+            pos += len - capacity;
+            len = capacity;
+        }
+
+        make_room(len);
+    }
+
+    while(queued < len) {
+        void *span;
+        size_t span_len = ringbuf_spsc_reserve(&console_buffer, &span);
+
+        if(span_len == 0) {
+            if(policy != CONSOLE_BLOCK)
+                break;
+
+            if(!waiting) {
+                waiting = true;
+                wait_start = timebase_now_ms();
+                ++stats.stalls;
+            }
+
+            if(timeout != CONSOLE_WAIT_FOREVER && timebase_now_ms() - wait_start >= timeout) {
+                ++stats.timeouts;
+                break;
+            }
+
+            // Let the host drain some of our buffer.
+            console_poll();
+            continue;
+        }
+
+        if(span_len > len - queued)
+            span_len = len - queued;
+
+        INSTRUMENT_BEGIN(console_ring_write);
+        memcpy(span, pos + queued, span_len);
+        ringbuf_spsc_commit(&console_buffer, span_len);
+        INSTRUMENT_END(console_ring_write);
+        queued += span_len;
+    }
+
+    if(waiting && timebase_now_ms() - wait_start > stats.max_wait_ms)
+        stats.max_wait_ms = timebase_now_ms() - wait_start;
+
+    stats.dropped_bytes += len - queued;
+    return queued;
+}
+
+size_t console_write(const void *data, size_t len)
+{
+    return console_write_policy(data, len, default_policy, default_timeout);
+}
+
+void console_putc(char c)
+{
+    console_write(&c, 1);
+}
+
+void console_puts(const char *str)
+{
+    console_write(str, strlen(str));
+}
+
+size_t console_bytes_free(void)
+{
+    return ringbuf_spsc_bytes_free(&console_buffer);
+}
+
+const struct console_stats *console_get_stats(void)
+{
+    return &stats;
+}
+
+void console_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+size_t console_tx_peek(const void **data)
+{
+    return ringbuf_spsc_peek_contiguous(&console_buffer, data);
+}
+
+void console_tx_consume(size_t len)
+{
+    ringbuf_spsc_consume(&console_buffer, len);
+}
+
+size_t console_tx_pending(void)
+{
+    return ringbuf_spsc_bytes_used(&console_buffer);
+}
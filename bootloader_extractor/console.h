@@ -0,0 +1,135 @@
+/*
+ * Console output buffering for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * What a console write should do if there isn't room for all of its data.
+ */
+enum console_policy {
+
+    // Service the host until there's room, giving up after the timeout
+    // (in milliseconds, on the timebase).
+    CONSOLE_BLOCK,
+
+    // Queue as much as fits right now, and drop the rest of this write.
+    CONSOLE_DROP_NEWEST,
+
+    // Discard the oldest unsent data to make room for this write.
+    CONSOLE_OVERWRITE_OLDEST,
+};
+
+/**
+ * Timeout for CONSOLE_BLOCK writes that should never give up.
+ */
+#define CONSOLE_WAIT_FOREVER (UINT32_MAX)
+
+/**
+ * Running statistics about console backpressure, since the console was set
+ * up or the statistics were last reset.
+ */
+struct console_stats {
+
+    // Bytes that were never queued (dropped, or timed out).
+    uint32_t dropped_bytes;
+
+    // Unsent bytes discarded to make room for newer ones.
+    uint32_t overwritten_bytes;
+
+    // Writes that had to wait for room before completing.
+    uint32_t stalls;
+
+    // Writes that gave up waiting for room.
+    uint32_t timeouts;
+
+    // The longest any single write has waited, in milliseconds.
+    uint32_t max_wait_ms;
+};
+
+/**
+ * Sets up the console.
+ *
+ * @param poll Called whenever a blocking write is waiting for room; should
+ *      service the host so it can drain the console.
+ */
+void console_init(void (*poll)(void));
+
+/**
+ * Sets the policy (and, for CONSOLE_BLOCK, the timeout in milliseconds) used
+ * by console_write, console_putc and console_puts.
+ */
+void console_set_policy(enum console_policy policy, uint32_t timeout);
+
+/**
+ * Queues data for transmission to the host using the given policy.
+ *
+ * @return The number of bytes actually queued.
+ */
+size_t console_write_policy(const void *data, size_t len,
+        enum console_policy policy, uint32_t timeout);
+
+/**
+ * Queues data for transmission to the host using the default policy.
+ */
+size_t console_write(const void *data, size_t len);
+void console_putc(char c);
+void console_puts(const char *str);
+
+/**
+ * @return The number of bytes that can be written right now without
+ *      waiting or dropping anything.
+ */
+size_t console_bytes_free(void);
+
+/**
+ * @return The console's backpressure statistics.
+ */
+const struct console_stats *console_get_stats(void);
+
+/**
+ * Clears the backpressure statistics, so each measurement can start afresh.
+ */
+void console_reset_stats(void);
+
+/**
+ * Transmit side: get the next contiguous span of queued data, and release
+ * it once it's been sent. Only the transmit path may call these.
+ */
+size_t console_tx_peek(const void **data);
+void console_tx_consume(size_t len);
+
+/**
+ * @return The number of bytes queued that the transmit side hasn't yet
+ *      released, whether or not they're contiguous.
+ */
+size_t console_tx_pending(void);
+
+/**
+ * Sets a function to be told whenever CONSOLE_OVERWRITE_OLDEST discards
+ * unsent data, so the transmit path can forget any of it it had claimed.
+ * It's called with interrupts masked, with the number of bytes discarded
+ * from the oldest end.
+ */
+void console_set_overwrite_handler(void (*handler)(size_t len));
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Software CRC-32 for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Initial value for a running CRC-32; pass it as crc to the first call
+ * to crc32_update.
+ */
+#define CRC32_INIT (0)
+
+/**
+ * Extends a running CRC-32 over len more bytes.
+ *
+ * This is the common reflected CRC-32 (as used by zlib and Ethernet), so
+ * results match Python's zlib.crc32 for the same data.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""
+Flips a running extractor into the DFU bootloader and back, and times it.
+
+The extractor's 'r dfu' command leaves a boot request for the boot selector
+and resets, so the DFU bootloader comes up without anyone holding UP and OK;
+leaving DFU mode with dfu-util -e does the same to return to the alternate
+firmware. If given a firmware image, this downloads it on the way through,
+making for a complete development round trip. The download leaves out
+:leave, as the reset at the end of one runs the FLIR firmware unless OK is
+held.
+
+Each time is from the request to the device enumerating again, as seen in
+sysfs, so this needs Linux and dfu-util.
+"""
+
+import os
+import subprocess
+import sys
+import time
+
+from serial import Serial
+
+APP_ID          = ('0483', '5740')
+DFU_ID          = ('0483', 'df11')
+FIRMWARE_BASE   = 0x08053000
+
+# How long to wait for the device to come back before giving up.
+TIMEOUT_SECONDS = 10.0
+POLL_SECONDS    = 0.002
+
+
+def usb_device_present(device_id):
+    """
+    return: True iff a device with the given (vendor, product) IDs is attached.
+    """
+
+    root = '/sys/bus/usb/devices'
+
+    for device in os.listdir(root):
+        try:
+            with open(os.path.join(root, device, 'idVendor')) as f:
+                vendor = f.read().strip()
+            with open(os.path.join(root, device, 'idProduct')) as f:
+                product = f.read().strip()
+        except OSError:
+            continue
+
+        if (vendor, product) == device_id:
+            return True
+
+    return False
+
+
+def wait_for(present, start):
+    """
+    Polls until present() is true.
+
+    return: Seconds since start, or None if we timed out.
+    """
+
+    while time.time() - start < TIMEOUT_SECONDS:
+        if present():
+            return time.time() - start
+        time.sleep(POLL_SECONDS)
+
+    return None
+
+
+def to_dfu(serial_port):
+    """
+    Asks the extractor to reboot into the DFU bootloader.
+
+    return: Seconds until the DFU bootloader enumerated.
+    """
+
+    sp = Serial(serial_port, timeout=1)
+    start = time.time()
+    sp.write(b'r dfu\r')
+    sp.close()
+
+    return wait_for(lambda: usb_device_present(DFU_ID), start)
+
+
+def to_app(serial_port, image=None):
+    """
+    Leaves the DFU bootloader for the alternate firmware, first downloading
+    the given image, if any.
+
+    return: (seconds spent downloading, seconds from leaving DFU mode until
+        the serial port was back)
+    """
+
+    device = '{}:{}'.format(*DFU_ID)
+    download = 0.0
+
+    if image:
+        start = time.time()
+        subprocess.check_call(['dfu-util', '-d', device, '-a', '0', '-s', '{:#x}'.format(FIRMWARE_BASE), '-D', image],
+                              stdout=subprocess.DEVNULL)
+        download = time.time() - start
+
+    start = time.time()
+    subprocess.check_call(['dfu-util', '-d', device, '-e'], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    back = wait_for(lambda: usb_device_present(APP_ID) and os.path.exists(serial_port), start)
+    return download, back
+
+
+def usage():
+    print("usage: {} <serial_port> [firmware.bin]".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) not in (2, 3):
+        usage()
+        sys.exit(0)
+
+    serial_port = sys.argv[1]
+    image = sys.argv[2] if len(sys.argv) == 3 else None
+
+    to_dfu_seconds = to_dfu(serial_port)
+    if to_dfu_seconds is None:
+        print("bench=dfu_cycle result=timeout stage=to_dfu")
+        sys.exit(1)
+
+    download_seconds, to_app_seconds = to_app(serial_port, image)
+    if to_app_seconds is None:
+        print("bench=dfu_cycle result=timeout stage=to_app")
+        sys.exit(1)
+
+    print("bench=dfu_cycle to_dfu_s={:.3f} download_s={:.3f} to_app_s={:.3f} total_s={:.3f}".format(
+        to_dfu_seconds, download_seconds, to_app_seconds,
+        to_dfu_seconds + download_seconds + to_app_seconds))
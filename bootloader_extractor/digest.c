@@ -0,0 +1,149 @@
+/*
+ * Memory digests for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "console.h"
+#include "digest.h"
+
+/**
+ * How much memory to digest per step. Small enough that even SHA-256 hands
+ * the main loop back within a few milliseconds; a multiple of four, so only
+ * the final chunk can end part way through a CRC word.
+ */
+#define DIGEST_CHUNK_SIZE (1024)
+
+/**
+ * The longest result line: "sha256: ", the digest, " length: XXXXXXXX\r\n".
+ */
+#define DIGEST_MAX_LINE (8 + 2 * SHA256_DIGEST_SIZE + 17 + 2)
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static char *format_hex(char *pos, uint32_t value, int digits)
+{
+    for(int i = digits - 1; i >= 0; --i)
+        *pos++ = hex_digits[(value >> (4 * i)) & 0xF];
+
+    return pos;
+}
+
+/**
+ * Feeds a chunk of memory to the CRC unit, a word at a time.
+ */
+static uint32_t crc_chunk(uintptr_t address, uint32_t len)
+{
+    uint32_t crc = CRC_DR;
+    uint32_t word;
+
+    // Aligned memory can be fed straight to the unit; the rest has to be
+    // picked up a word at a time.
+    if(!(address & 3) && len >= 4) {
+        crc = crc_calculate_block((uint32_t *)address, len / 4);
+        address += len & ~3;
+    } else {
+        for(; len >= 4; len -= 4, address += 4) {
+            memcpy(&word, (const void *)address, 4);
+            crc = crc_calculate(word);
+        }
+    }
+
+    // Pad out any partial word at the end with zeroes.
+    if(len & 3) {
+        word = 0;
+        memcpy(&word, (const void *)address, len & 3);
+        crc = crc_calculate(word);
+    }
+
+    return crc;
+}
+
+void digest_start(struct digest_transfer *transfer, enum digest_algorithm algorithm,
+        uint32_t address, uint32_t length)
+{
+    transfer->algorithm = algorithm;
+    transfer->address = address;
+    transfer->length = length;
+    transfer->remaining = length;
+
+    if(algorithm == DIGEST_SHA256) {
+        sha256_init(&transfer->sha256);
+    } else {
+        rcc_periph_clock_enable(RCC_CRC);
+        crc_reset();
+        transfer->crc = CRC_DR;
+    }
+}
+
+/**
+ * Queues the finished digest for the host.
+ */
+static void report(struct digest_transfer *transfer)
+{
+    char line[DIGEST_MAX_LINE];
+    char *pos = line;
+
+    if(transfer->algorithm == DIGEST_SHA256) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+
+        sha256_finish(&transfer->sha256, digest);
+
+        memcpy(pos, "sha256: ", 8);
+        pos += 8;
+        for(size_t i = 0; i < sizeof(digest); ++i)
+            pos = format_hex(pos, digest[i], 2);
+    } else {
+        memcpy(pos, "crc32: ", 7);
+        pos = format_hex(pos + 7, transfer->crc, 8);
+    }
+
+    memcpy(pos, " length: ", 9);
+    pos = format_hex(pos + 9, transfer->length, 8);
+    *pos++ = '\r';
+    *pos++ = '\n';
+
+    console_write(line, pos - line);
+}
+
+bool digest_step(struct digest_transfer *transfer)
+{
+    uint32_t chunk = transfer->remaining;
+
+    if(!chunk) {
+        // Wait until the whole result fits, so it's never split or truncated.
+        if(console_bytes_free() < DIGEST_MAX_LINE)
+            return false;
+
+        report(transfer);
+        return true;
+    }
+
+    if(chunk > DIGEST_CHUNK_SIZE)
+        chunk = DIGEST_CHUNK_SIZE;
+
+    if(transfer->algorithm == DIGEST_SHA256)
+        sha256_update(&transfer->sha256, (const void *)(uintptr_t)transfer->address, chunk);
+    else
+        transfer->crc = crc_chunk(transfer->address, chunk);
+
+    transfer->address += chunk;
+    transfer->remaining -= chunk;
+    return false;
+}
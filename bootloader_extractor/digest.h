@@ -0,0 +1,75 @@
+/*
+ * Memory digests for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/*
+ * Digests let the host check a region of memory against an image it already
+ * has, without transferring the region itself. Each is reported as a single
+ * line of text:
+ *
+ *   crc32: XXXXXXXX length: XXXXXXXX
+ *   sha256: <64 hex digits> length: XXXXXXXX
+ *
+ * The CRC is computed by the STM32's CRC unit, so it isn't the common
+ * (zlib) CRC-32: the polynomial is 0x04C11DB7, the initial value 0xFFFFFFFF,
+ * and data is fed in as little-endian 32-bit words, most significant bit
+ * first, with no final XOR. A length that isn't a multiple of four has its
+ * last word padded out with zeroes. digest.py computes the same values.
+ */
+enum digest_algorithm {
+    DIGEST_CRC32,
+    DIGEST_SHA256,
+};
+
+/**
+ * The state of a digest that's being computed.
+ */
+struct digest_transfer {
+    enum digest_algorithm algorithm;
+    uint32_t address;
+    uint32_t length;
+    uint32_t remaining;
+
+    uint32_t crc;
+    struct sha256_context sha256;
+};
+
+/**
+ * Prepares to digest the given range of memory, which must be readable
+ * (see bindump_range_readable). Only one CRC can be in progress at a time,
+ * as it's held in the CRC unit.
+ */
+void digest_start(struct digest_transfer *transfer, enum digest_algorithm algorithm,
+        uint32_t address, uint32_t length);
+
+/**
+ * Digests the next chunk of the range; once it's all done, reports the
+ * result to the host.
+ *
+ * @return True once the result has been queued.
+ */
+bool digest_step(struct digest_transfer *transfer);
+
+#endif
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""
+Checks a device's memory against a local image, by digest.
+
+Computes the same digest the extractor's 'c' command does over a local
+image, and optionally asks a device for its digest of the same range; only
+if the two differ (and we've been asked to) is the range actually fetched.
+See digest.h in the firmware for how the CRC is defined.
+"""
+
+import hashlib
+import re
+import struct
+import sys
+
+# The STM32 CRC unit's polynomial, fed most significant bit first.
+CRC_POLYNOMIAL = 0x04C11DB7
+
+
+def _make_crc_table():
+    table = []
+
+    for byte in range(256):
+        crc = byte << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ CRC_POLYNOMIAL) if crc & 0x80000000 else (crc << 1)
+        table.append(crc & 0xFFFFFFFF)
+
+    return table
+
+
+CRC_TABLE = _make_crc_table()
+
+
+def stm32_crc(data):
+    """
+    Computes the CRC the STM32's CRC unit produces for the given data, fed to
+    it as little-endian words, with any partial word at the end zero-padded.
+    """
+
+    crc = 0xFFFFFFFF
+    data = bytes(data) + bytes(-len(data) % 4)
+
+    # The unit takes each word most significant byte first, which is the
+    # reverse of the order its bytes sit in memory.
+    for word, in struct.iter_unpack('>I', data):
+        for shift in (0, 8, 16, 24):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ ((word >> shift) & 0xFF)]
+
+    return crc
+
+
+def local_digest(data, algorithm):
+    """
+    return: The digest of the given data, formatted as the device reports it.
+    """
+
+    if algorithm == 'sha256':
+        return hashlib.sha256(data).hexdigest().upper()
+
+    return '{:08X}'.format(stm32_crc(data))
+
+
+def device_digest(sp, address, length, algorithm):
+    """
+    Asks the device for its digest of the given range.
+
+    return: The digest, formatted as the device reports it.
+    """
+
+    command = 'c 0x{:x} 0x{:x}'.format(address, length)
+    if algorithm == 'sha256':
+        command += ' sha256'
+
+    sp.write((command + '\r').encode())
+
+    line = sp.readline().decode(errors='replace')
+    match = re.match(r'(crc32|sha256): ([0-9A-F]+) length: ([0-9A-F]{8})', line)
+
+    if not match or int(match.group(3), 16) != length:
+        raise IOError("unexpected reply from device: {!r}".format(line))
+
+    return match.group(2)
+
+
+def usage():
+    print("usage: {} <image> <address> [crc32|sha256] [<serial_port> [<fetch_filename>]]".format(sys.argv[0]))
+    print("  Prints the digest of an image that belongs at the given address; if a serial")
+    print("  port is given, compares it to the device's memory, and if a fetch filename is")
+    print("  also given, reads the device's copy into that file should they differ.")
+
+
+if __name__ == '__main__':
+
+    args = sys.argv[1:]
+
+    if len(args) < 2:
+        usage()
+        sys.exit(0)
+
+    image_file = args.pop(0)
+    address = int(args.pop(0), 0)
+
+    algorithm = 'crc32'
+    if args and args[0] in ('crc32', 'sha256'):
+        algorithm = args.pop(0)
+
+    if len(args) > 2:
+        usage()
+        sys.exit(0)
+
+    with open(image_file, 'rb') as f:
+        image = f.read()
+
+    expected = local_digest(image, algorithm)
+    print("image={} address=0x{:08x} length={} {}={}".format(image_file, address, len(image), algorithm, expected))
+
+    if not args:
+        sys.exit(0)
+
+    from serial import Serial
+
+    sp = Serial(args[0], timeout=5)
+    actual = device_digest(sp, address, len(image), algorithm)
+    matches = (actual == expected)
+
+    print("device={} {}={} match={}".format(args[0], algorithm, actual, 'yes' if matches else 'no'))
+
+    # Only transfer the range itself if we have to.
+    if not matches and len(args) == 2:
+        from rx_bootloader import read_memory_binary
+
+        sp.close()
+        with open(args[1], 'wb') as f:
+            f.write(read_memory_binary(args[0], address, len(image)))
+
+    sys.exit(0 if matches else 1)
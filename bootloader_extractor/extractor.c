@@ -24,27 +24,141 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/cdc.h>
+#include <libopencm3/usb/dfu.h>
 #include <string.h>
 
-#include "ringbuf.h"
+#include "bindump.h"
+#include "boot_request.h"
+#include "capture.h"
+#include "cmdline.h"
+#include "console.h"
+#include "digest.h"
+#include "ihex.h"
+#include "instrument.h"
+#include "log.h"
+#include "profile.h"
+#include "sched.h"
+#include "thermal.h"
+#include "timebase.h"
+#include "trace.h"
+#include "usb_connect.h"
+#include "usb_dblbuf.h"
 
 // The maximum packet size for the bulk endpoints for our ACM device.
 #define MAX_PACKET_SIZE (64)
 
-// Duration for a power-button press to be considered a long press.
-// Units are arbitrary, but higher is longer. :)
-#define LONG_PRESS_DURATION (0x10000)
+// The interface that follows the ACM device's two, for DFU runtime requests.
+#define DFU_RUNTIME_INTERFACE (2)
+
+// Whether to double-buffer the CDC data endpoints; see usb_dblbuf.h.
+// Normally set from the Makefile.
+#ifndef EXTRACTOR_DBLBUF_IN
+#define EXTRACTOR_DBLBUF_IN (1)
+#endif
+#ifndef EXTRACTOR_DBLBUF_OUT
+#define EXTRACTOR_DBLBUF_OUT (0)
+#endif
+
+// Whether to service USB from its interrupts, sleeping whenever there's
+// nothing else to do, rather than polling it from the main loop.
+// Normally set from the Makefile.
+#ifndef EXTRACTOR_USB_IRQ
+#define EXTRACTOR_USB_IRQ (1)
+#endif
+
+// Packet memory for the data endpoints' second buffers. libopencm3 hands out
+// packet memory from 0x40 up as endpoints are set up -- 64 bytes each for
+// EP0's OUT and IN buffers, our two data endpoints, then 16 bytes for the
+// notification endpoint -- ending at 0x150. Ours go at the top of the 512 bytes.
+#define DATA_OUT_SECOND_BUFFER (0x180)
+#define DATA_IN_SECOND_BUFFER (0x1C0)
+
+// Duration for a power-button press to be considered a long press, in
+// milliseconds; about what the main loop's old iteration count came to.
+#define LONG_PRESS_DURATION_MS (300)
+
+// How often we fold the cycle counter into our CPU usage figures (well inside
+// the minute it takes to wrap).
+#define CPU_USAGE_SAMPLE_MS (1000)
+
+// The USB interrupts' priority: below the profiler's (see profile.h), so it
+// can sample inside them. Only the top four bits are implemented.
+#define USB_IRQ_PRIORITY (1 << 4)
 
 usbd_device *usbdev;
 
+/**
+ * True when the data IN endpoint is configured but has no packet in flight,
+ * so the main loop has to start the next transmission itself. When the
+ * endpoint is double-buffered, this stays set once it's configured, as the
+ * main loop keeps its spare buffer topped up.
+ */
+static bool tx_idle;
+
+#if EXTRACTOR_DBLBUF_IN
+static struct usb_dblbuf_in data_in;
+#endif
+#if EXTRACTOR_DBLBUF_OUT
+static struct usb_dblbuf_out data_out;
+#endif
+
+/**
+ * Somewhere the IN endpoint can send data from, directly.
+ */
+struct tx_source {
+    enum {
+        // The next 'remaining' bytes of the console buffer.
+        TX_SOURCE_CONSOLE,
+
+        // A range of memory (e.g. flash), sent in place.
+        TX_SOURCE_MEMORY,
+    } type;
+
+    const uint8_t *data;
+    size_t remaining;
+};
+
+/**
+ * Sources queued for transmission, in order. Once these have all been
+ * sent, the endpoint sends from the console buffer. Only the main loop adds
+ * to this queue, and only the transmit path removes from it.
+ */
+#define TX_QUEUE_LENGTH (8)
+static struct tx_source tx_queue[TX_QUEUE_LENGTH];
+static volatile size_t tx_queue_head, tx_queue_tail;
+
+#if !EXTRACTOR_DBLBUF_OUT
+/**
+ * True while we're holding off the host because the command engine can't
+ * take another packet; see receive_from_host.
+ */
+static bool rx_paused;
+#endif
 
 /**
- * Stores a buffer for console communications with the host.
+ * The longest the RX callback has taken, in CPU cycles.
  */
-static uint8_t raw_buffer[4096];
-static struct ringbuf_t console_buffer;
+static uint32_t rx_callback_max_cycles;
+
+/**
+ * The cycles the CPU has spent awake since startup. The cycle counter stops
+ * while we sleep (unless a debugger is keeping the core's clock running), so
+ * comparing this with the timebase tells us how busy we've been. It's 32
+ * bits, and wraps in about a minute, so we fold it in here periodically.
+ */
+static uint64_t active_cycles;
+static uint32_t last_cycle_count;
+
+/**
+ * Our periodic work: sampling the cycle count. (The tick interrupt watches
+ * the power button itself.)
+ */
+static struct sched_timer cpu_usage_timer;
 
 
 static const struct usb_device_descriptor dev = {
@@ -160,19 +274,51 @@ static const struct usb_interface_descriptor data_iface[] = {{
   .endpoint = data_endp,
 }};
 
+/*
+ * A DFU runtime interface, so the host can ask us to reboot into the DFU
+ * bootloader (e.g. with dfu-util -e) rather than someone holding UP and OK.
+ * We detach ourselves, by resetting, as soon as we're asked.
+ */
+static const struct usb_dfu_descriptor dfu_runtime_function = {
+  .bLength = sizeof(struct usb_dfu_descriptor),
+  .bDescriptorType = DFU_FUNCTIONAL,
+  .bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_WILL_DETACH,
+  .wDetachTimeout = 255,
+  .wTransferSize = 1024,
+  .bcdDFUVersion = 0x011A,
+};
+
+static const struct usb_interface_descriptor dfu_runtime_iface[] = {{
+  .bLength = USB_DT_INTERFACE_SIZE,
+  .bDescriptorType = USB_DT_INTERFACE,
+  .bInterfaceNumber = DFU_RUNTIME_INTERFACE,
+  .bAlternateSetting = 0,
+  .bNumEndpoints = 0,
+  .bInterfaceClass = 0xFE, /* Device Firmware Upgrade */
+  .bInterfaceSubClass = 1,
+  .bInterfaceProtocol = 1, /* Runtime */
+  .iInterface = 4,
+
+  .extra = &dfu_runtime_function,
+  .extralen = sizeof(dfu_runtime_function),
+}};
+
 static const struct usb_interface ifaces[] = {{
   .num_altsetting = 1,
   .altsetting = comm_iface,
 }, {
   .num_altsetting = 1,
   .altsetting = data_iface,
+}, {
+  .num_altsetting = 1,
+  .altsetting = dfu_runtime_iface,
 }};
 
 static const struct usb_config_descriptor config = {
   .bLength = USB_DT_CONFIGURATION_SIZE,
   .bDescriptorType = USB_DT_CONFIGURATION,
   .wTotalLength = 0,
-  .bNumInterfaces = 2,
+  .bNumInterfaces = 3,
   .bConfigurationValue = 1,
   .iConfiguration = 0,
   .bmAttributes = 0x80,
@@ -185,11 +331,43 @@ static const char *usb_strings[] = {
   "Not Exactly FLIR (TM)",
   "Bootloader Extractor",
   "ABCD",
+  "Reboot to DFU Bootloader",
 };
 
 /* Buffer to be used for control requests. */
 uint8_t usbd_control_buffer[128];
 
+static void dfu_detach_complete(usbd_device *usbd_dev, struct usb_setup_data *req)
+{
+  (void)req;
+  (void)usbd_dev;
+
+  /* The host has its answer; detach by rebooting into the DFU bootloader. */
+  trace(TRACE_RESET, TRACE_RESET_DETACH, BOOT_REQUEST_ALT_BOOTLOADER);
+  boot_request_reset(BOOT_REQUEST_ALT_BOOTLOADER);
+}
+
+static int dfu_runtime_control_request(struct usb_setup_data *req, uint8_t **buf,
+    uint16_t *len, void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req))
+{
+  switch(req->bRequest) {
+  case DFU_DETACH:
+    *complete = dfu_detach_complete;
+    return 1;
+  case DFU_GETSTATUS:
+    /* Status OK, no poll timeout, in appIDLE, no status string. */
+    memset(*buf, 0, 6);
+    (*buf)[4] = STATE_APP_IDLE;
+    *len = 6;
+    return 1;
+  case DFU_GETSTATE:
+    (*buf)[0] = STATE_APP_IDLE;
+    *len = 1;
+    return 1;
+  }
+  return 0;
+}
+
 static int cdcacm_control_request(usbd_device *usbd_dev, struct usb_setup_data *req, uint8_t **buf,
     uint16_t *len, void (**complete)(usbd_device *usbd_dev, struct usb_setup_data *req))
 {
@@ -197,6 +375,9 @@ static int cdcacm_control_request(usbd_device *usbd_dev, struct usb_setup_data *
   (void)buf;
   (void)usbd_dev;
 
+  if(req->wIndex == DFU_RUNTIME_INTERFACE)
+    return dfu_runtime_control_request(req, buf, len, complete);
+
   switch(req->bRequest) {
   case USB_CDC_REQ_SET_CONTROL_LINE_STATE: {
     /*
@@ -226,28 +407,319 @@ static int cdcacm_control_request(usbd_device *usbd_dev, struct usb_setup_data *
   return 0;
 }
 
-static void console_putc(char c)  {
-    while(ringbuf_is_full(&console_buffer))
-      usbd_poll(usbdev);
+static size_t tx_queue_next(size_t index)
+{
+    return (index + 1) % TX_QUEUE_LENGTH;
+}
+
+/**
+ * Queues a range of memory to be sent to the host as-is, after anything
+ * already written to the console. Returns immediately; the data is read
+ * straight from memory as each packet goes out.
+ *
+ * @return False if there wasn't room in the transmit queue.
+ */
+static bool tx_queue_memory(const void *data, size_t len)
+{
+    size_t tail = tx_queue_tail;
+    size_t console_pending, entries_needed, entries_free;
+
+    // Work out how much console data isn't already claimed by a queued
+    // source, and claim it, without the transmit path sending any of it
+    // meanwhile: if it sent some between our count and our claim, we'd be
+    // claiming bytes that come after ours. Masking also keeps it from seeing
+    // the new entries until they're complete.
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    console_pending = console_tx_pending();
+    for(size_t i = tx_queue_head; i != tail; i = tx_queue_next(i)) {
+        if(tx_queue[i].type == TX_SOURCE_CONSOLE)
+            console_pending -= tx_queue[i].remaining;
+    }
+
+    entries_free = (tx_queue_head + TX_QUEUE_LENGTH - tail - 1) % TX_QUEUE_LENGTH;
+    entries_needed = console_pending ? 2 : 1;
+    if(entries_free < entries_needed) {
+        cm_mask_interrupts(was_masked);
+        return false;
+    }
 
-    ringbuf_memcpy_into(&console_buffer, &c, 1);
+    // Anything already in the console has to go out first...
+    if(console_pending) {
+        tx_queue[tail].type = TX_SOURCE_CONSOLE;
+        tx_queue[tail].remaining = console_pending;
+        tail = tx_queue_next(tail);
+    }
+
+    // ... followed by our data.
+    tx_queue[tail].type = TX_SOURCE_MEMORY;
+    tx_queue[tail].data = data;
+    tx_queue[tail].remaining = len;
+    tx_queue_tail = tx_queue_next(tail);
+
+    cm_mask_interrupts(was_masked);
+    return true;
+}
+
+/**
+ * Forgets console data that's been overwritten before it could be sent. The
+ * oldest console data is whatever the first queued console sources claim,
+ * so they give it up first. This keeps what's queued from claiming more
+ * than the console holds.
+ */
+static void tx_queue_overwritten(size_t len)
+{
+    for(size_t i = tx_queue_head; len && i != tx_queue_tail; i = tx_queue_next(i)) {
+        size_t claimed;
+
+        if(tx_queue[i].type != TX_SOURCE_CONSOLE)
+            continue;
+
+        claimed = (len < tx_queue[i].remaining) ? len : tx_queue[i].remaining;
+        tx_queue[i].remaining -= claimed;
+        len -= claimed;
+    }
+}
+
+/**
+ * Finds the next contiguous span of data to transmit, dropping any
+ * finished sources from the queue along the way.
+ */
+static size_t tx_peek(const void **data)
+{
+    while(tx_queue_head != tx_queue_tail) {
+        struct tx_source *source = &tx_queue[tx_queue_head];
+
+        if(source->remaining) {
+            size_t len;
+
+            if(source->type == TX_SOURCE_MEMORY) {
+                *data = source->data;
+                return source->remaining;
+            }
+
+            len = console_tx_peek(data);
+            return (len < source->remaining) ? len : source->remaining;
+        }
+
+        tx_queue_head = tx_queue_next(tx_queue_head);
+    }
+
+    return console_tx_peek(data);
+}
+
+/**
+ * Marks len bytes from the span found by tx_peek as sent.
+ */
+static void tx_consume(size_t len)
+{
+    struct tx_source *source;
+
+    if(tx_queue_head == tx_queue_tail) {
+        console_tx_consume(len);
+        return;
+    }
+
+    source = &tx_queue[tx_queue_head];
+    source->remaining -= len;
+
+    if(source->type == TX_SOURCE_MEMORY)
+        source->data += len;
+    else
+        console_tx_consume(len);
 }
 
-static void console_puts(char * str) {
-    size_t len = strlen(str);
+#if EXTRACTOR_DBLBUF_IN
+
+/**
+ * Stages the next packet in the IN endpoint's spare buffer, if there's
+ * anything to send and the buffer's free. This is the only place transmitted
+ * data is copied: straight from its source into
+ * the USB peripheral's packet memory.
+ */
+static void transmit_next_packet(usbd_device *usbd_dev)
+{
+    (void)usbd_dev;
+
+    while(usb_dblbuf_in_can_write(&data_in)) {
+        const void *to_transmit;
+        size_t len = tx_peek(&to_transmit);
 
-    // TODO: Chunk up the string, rather than failing, here.
-    // Since this is a quick hack that should never need this,
-    // I'm not implementing this at the moment.
-    if(len > ringbuf_capacity(&console_buffer)) {
-        console_puts("OVERRUN!\r\n");
+        if(len == 0)
+            return;
+
+        if(len > MAX_PACKET_SIZE)
+            len = MAX_PACKET_SIZE;
+
+        usb_dblbuf_in_write(&data_in, to_transmit, len);
+        tx_consume(len);
+    }
+}
+
+#else
+
+/**
+ * Sends the next packet to the host, if there's anything to send. This is
+ * the only place transmitted data is copied: straight from its source into
+ * the USB peripheral's packet memory.
+ */
+static void transmit_next_packet(usbd_device *usbd_dev)
+{
+    const void *to_transmit;
+    size_t len = tx_peek(&to_transmit);
+
+    // If we don't have any data to send, return without transmitting;
+    // the main loop will start things back up once there's more.
+    if(len == 0) {
+        tx_idle = true;
         return;
     }
 
-    while(ringbuf_bytes_free(&console_buffer) < len)
-      usbd_poll(usbdev);
+    // If we can't send this all in one packet, send as much as we can.
+    if(len > MAX_PACKET_SIZE)
+        len = MAX_PACKET_SIZE;
+
+    // Transmit straight from the source, and only then release the data.
+    // If the endpoint wasn't ready after all, leave the data where it is,
+    // and try again later.
+    if(usbd_ep_write_packet(usbd_dev, 0x82, to_transmit, len) == 0) {
+        tx_idle = true;
+        return;
+    }
 
-    ringbuf_memcpy_into(&console_buffer, str, len);
+    tx_idle = false;
+    tx_consume(len);
+}
+
+#endif
+
+#if EXTRACTOR_DBLBUF_OUT
+
+/**
+ * Hands packets the host has sent to the command engine, for as long as it
+ * has room for them. Any we can't take yet stay in the endpoint's buffers,
+ * and once both are full the peripheral holds off the host by itself.
+ */
+static void receive_from_host(usbd_device *usbd_dev)
+{
+    char buf[MAX_PACKET_SIZE];
+    uint16_t len;
+
+    (void)usbd_dev;
+
+    while(cmdline_receive_room() >= MAX_PACKET_SIZE &&
+            usb_dblbuf_out_read(&data_out, buf, sizeof(buf), &len))
+        cmdline_receive(buf, len);
+}
+
+#else
+
+/**
+ * Hands the packet the host has just sent to the command engine. If that
+ * leaves it without room for another, hold off the host -- rather than
+ * dropping data -- until the main loop has caught up.
+ */
+static void receive_from_host(usbd_device *usbd_dev)
+{
+    char buf[MAX_PACKET_SIZE];
+    int len = usbd_ep_read_packet(usbd_dev, 0x01, buf, sizeof(buf));
+
+    cmdline_receive(buf, len);
+
+    if(cmdline_receive_room() < MAX_PACKET_SIZE) {
+        rx_paused = true;
+        usbd_ep_nak_set(usbd_dev, 0x01, 1);
+    }
+}
+
+#endif
+
+INSTRUMENT_REGION(usbd_poll);
+INSTRUMENT_REGION(cdcacm_tx_ready_cb);
+INSTRUMENT_REGION(hex_dump_line);
+INSTRUMENT_REGION(bindump_step);
+
+/**
+ * Handles any pending USB events, from the main loop or the USB interrupts.
+ */
+static void poll_usb(void)
+{
+    INSTRUMENT_BEGIN(usbd_poll);
+    usbd_poll(usbdev);
+    INSTRUMENT_END(usbd_poll);
+}
+
+/**
+ * Services the host: handles any pending USB events, and restarts
+ * transmission if new console data has arrived since the endpoint went idle.
+ * Used by the main loop, and by the console while it waits for room.
+ */
+static void service_usb(void)
+{
+#if EXTRACTOR_USB_IRQ
+    // The USB interrupts handle events for us; just keep them from running
+    // while we work with the state we share with them.
+    uint32_t was_masked = cm_mask_interrupts(1);
+#else
+    poll_usb();
+#endif
+
+#if EXTRACTOR_DBLBUF_OUT
+    // Pick up anything we had to leave in the endpoint's buffers for lack of room.
+    receive_from_host(usbdev);
+#else
+    // Let the host send again once there's room for a whole packet.
+    if(rx_paused && cmdline_receive_room() >= MAX_PACKET_SIZE) {
+        rx_paused = false;
+        usbd_ep_nak_set(usbdev, 0x01, 0);
+    }
+#endif
+
+    if(tx_idle) {
+#if EXTRACTOR_DBLBUF_IN
+        usb_dblbuf_in_service(&data_in, false);
+#endif
+        transmit_next_packet(usbdev);
+    }
+
+#if EXTRACTOR_USB_IRQ
+    cm_mask_interrupts(was_masked);
+#endif
+}
+
+/**
+ * Sleeps until the next interrupt, unless idle() says there's already
+ * something to do. Interrupts are masked between the check and the WFI, so
+ * none can slip in unnoticed: a pending interrupt still wakes us, and is
+ * handled as soon as we unmask.
+ */
+static void sleep_while_idle(bool (*idle)(void))
+{
+#if EXTRACTOR_USB_IRQ
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    if(idle())
+        __asm__("wfi");
+
+    cm_mask_interrupts(was_masked);
+#else
+    (void)idle;
+#endif
+}
+
+static bool console_full(void)
+{
+    return console_bytes_free() == 0;
+}
+
+/**
+ * Waits for the host to drain some of the console; used by the console
+ * while a write is blocked for lack of room.
+ */
+static void wait_for_host(void)
+{
+    service_usb();
+    sleep_while_idle(console_full);
 }
 
 /* make a nybble into an ascii hex character 0 - 9, A-F */
@@ -269,91 +741,579 @@ static void dump_word(uint16_t w)
 }
 
 /* send a 32 bit value as 8 hex characters to the console */
-static void dump_long(uint16_t l)
+static void dump_long(uint32_t l)
 {
     dump_word(l >> 16);
     dump_word(l & 0xFFFF);
 }
 
-/*
- * dump a 'line' (an address, 16 bytes, and then the
- * ASCII representation of those bytes) to the console.
- * Takes an address (and possiblye a 'base' parameter
- * so that you can offset the address) and sends 16
- * bytes out. Returns the address +16 so you can
- * just call it repeatedly and it will send the
- * next 16 bytes out.
- */
-static uint8_t * dump_line(uint8_t *addr, uint8_t *base)
-{
-  uint8_t *line_addr;
-  uint32_t tmp;
-
-  // Start the checksum with the first byte we're sending:
-  // the length of the record, 0x10 bytes.
-  uint8_t checksum = 0x10;
-
-  line_addr = addr;
-  tmp = (uint32_t)line_addr - (uint32_t) base;
-  
-  // Print the intel hex header...
-  console_puts(":10");
-
-  // ... the current working address...
-  dump_word((uint16_t)tmp);
-  checksum += tmp >> 8;
-  checksum += tmp & 0xFF;
-
-  // ... that this is a data line ...
-  console_puts("00");
-
-  // ... the record itself...
-  for (int i = 0; i < 16; i++) {
-    uint8_t byte = *(line_addr+i);
-
-    dump_byte(byte);
-    checksum += byte;
-  }
+/**
+ * Room for a page of Intel HEX records, formatted in one pass before being
+ * handed to the console all at once.
+ */
+#define HEX_LINES_PER_PAGE (16)
+static char hex_page[HEX_LINES_PER_PAGE * IHEX_MAX_ENCODED_SIZE];
+
+/**
+ * The state of the Intel HEX dump in progress, if any.
+ */
+static struct {
+    uintptr_t addr;
+    size_t remaining;
+    uintptr_t base;
+    uint16_t upper;
+} hex_dump;
+
+/**
+ * Dumps the next page of the current Intel HEX dump, once the console has
+ * room for all of it. Extended linear address records are emitted as
+ * needed, so ranges past 64KiB come out correctly.
+ */
+static bool hex_dump_step(void)
+{
+    size_t page_len = 0;
+
+    if(console_bytes_free() < sizeof(hex_page))
+        return false;
+
+    if(!hex_dump.remaining) {
+        console_puts(IHEX_EOF_RECORD);
+        return true;
+    }
+
+    // Format a page's worth of records...
+    for(int i = 0; i < HEX_LINES_PER_PAGE && hex_dump.remaining; ++i) {
+        uint32_t offset = hex_dump.addr - hex_dump.base;
+        size_t chunk = IHEX_MAX_DATA;
+
+        // ... never letting a record cross into the next 64KiB window.
+        if(chunk > 0x10000 - (offset & 0xFFFF))
+            chunk = 0x10000 - (offset & 0xFFFF);
+        if(chunk > hex_dump.remaining)
+            chunk = hex_dump.remaining;
 
-  // ... and finally, the checksum.
-  dump_byte(~checksum + 1);
+        INSTRUMENT_BEGIN(hex_dump_line);
+        page_len += ihex_encode_data(&hex_page[page_len], offset,
+                (const uint8_t *)hex_dump.addr, chunk, &hex_dump.upper);
+        INSTRUMENT_END(hex_dump_line);
 
-  console_puts("\r\n");
-  return line_addr;
+        hex_dump.addr += chunk;
+        hex_dump.remaining -= chunk;
+    }
+
+    // ... and queue it all at once.
+    console_write(hex_page, page_len);
+    return false;
 }
 
-/*
- * dump a 'page' like the function dump_line except this
- * does 16 lines for a total of 256 bytes. Back in the
- * day when you had a 24 x 80 terminal this fit nicely
- * on the screen with some other information.
+/**
+ * Starts dumping a range of memory to the console as Intel HEX, with
+ * addresses relative to base.
  */
-static uint8_t * dump_page(uint8_t *addr, uint8_t *base)
+static void dump_hex_range(uintptr_t addr, size_t length, uintptr_t base)
 {
-  int i;
-  for (i = 0; i < 16; i++) {
-    dump_line(addr + (i * 16), base);
-  }
-  return addr;
+    hex_dump.addr = addr;
+    hex_dump.remaining = length;
+    hex_dump.base = base;
+    hex_dump.upper = 0;
+
+    cmdline_start_job(hex_dump_step);
 }
 
+static void usage_error(const char *usage)
+{
+    console_puts("usage: ");
+    console_puts(usage);
+    console_puts("\r\n");
+}
+
+#define DUMP_HEX_USAGE "d [address length]: dump memory as Intel HEX (default: bootloader)"
 
-static void dump_bootloader(void)
+static void command_dump_hex(int argc, char **argv)
 {
-    uintptr_t addr;
+    uint32_t address, length;
+
+    // With no arguments, dump the bootloader, addressed from zero.
+    if(argc == 1) {
+        dump_hex_range(0x08000000, 0x10000, 0x08000000);
+        return;
+    }
+
+    if(argc != 3 || !cmdline_parse_u32(argv[1], &address) || !cmdline_parse_u32(argv[2], &length)) {
+        usage_error(DUMP_HEX_USAGE);
+        return;
+    }
+
+    if(!bindump_range_readable(address, length)) {
+        LOG("Can't read that range!\r\n");
+        return;
+    }
+
+    dump_hex_range(address, length, 0);
+}
+
+/**
+ * The binary dump in progress, if any.
+ */
+static struct bindump_transfer binary_dump;
+
+static bool binary_dump_step(void)
+{
+    bool finished;
+
+    INSTRUMENT_BEGIN(bindump_step);
+    finished = bindump_step(&binary_dump);
+    INSTRUMENT_END(bindump_step);
+
+    return finished;
+}
+
+#define DUMP_BINARY_USAGE "b address length [z]: dump memory as binary frames, compressed with z"
+
+static void command_dump_binary(int argc, char **argv)
+{
+    uint32_t address, length;
+    bool compress = false;
+
+    if(argc < 3 || argc > 4 || !cmdline_parse_u32(argv[1], &address) || !cmdline_parse_u32(argv[2], &length)) {
+        usage_error(DUMP_BINARY_USAGE);
+        return;
+    }
+
+    if(argc == 4) {
+        if(!cmdline_matches("z", argv[3])) {
+            usage_error(DUMP_BINARY_USAGE);
+            return;
+        }
+
+        compress = true;
+    }
+
+    // Bad ranges are reported in-band, as the host is expecting frames.
+    if(bindump_start(&binary_dump, address, length, compress))
+        cmdline_start_job(binary_dump_step);
+}
+
+#define DUMP_RAW_USAGE "x address length: stream raw memory, with no framing"
+
+static void command_dump_raw(int argc, char **argv)
+{
+    uint32_t address, length;
+
+    if(argc != 3 || !cmdline_parse_u32(argv[1], &address) || !cmdline_parse_u32(argv[2], &length)) {
+        usage_error(DUMP_RAW_USAGE);
+        return;
+    }
+
+    if(!bindump_range_readable(address, length)) {
+        LOG("Can't read that range!\r\n");
+        return;
+    }
+
+    // Memory is sent in place, so there's nothing more for us to do.
+    if(!tx_queue_memory((const void *)(uintptr_t)address, length))
+        LOG("Transmit queue full!\r\n");
+}
+
+/**
+ * The digest being computed, if any.
+ */
+static struct digest_transfer memory_digest;
+
+static bool digest_job_step(void)
+{
+    return digest_step(&memory_digest);
+}
+
+#define DIGEST_USAGE "c address length [sha256]: digest memory (hardware CRC by default); see digest.py"
+
+static void command_digest(int argc, char **argv)
+{
+    uint32_t address, length;
+    enum digest_algorithm algorithm = DIGEST_CRC32;
 
-    for(addr = 0x08000000; addr < 0x08010000; addr += 256)
-        dump_page((uint8_t *)addr, (uint8_t *)0x08000000);
+    if(argc < 3 || argc > 4 || !cmdline_parse_u32(argv[1], &address) || !cmdline_parse_u32(argv[2], &length)) {
+        usage_error(DIGEST_USAGE);
+        return;
+    }
+
+    if(argc == 4) {
+        if(!cmdline_matches("sha256", argv[3])) {
+            usage_error(DIGEST_USAGE);
+            return;
+        }
 
-    // Send an EOF.
-    console_puts(":00000001FF\r\n");
+        algorithm = DIGEST_SHA256;
+    }
+
+    if(!bindump_range_readable(address, length)) {
+        LOG("Can't read that range!\r\n");
+        return;
+    }
+
+    digest_start(&memory_digest, algorithm, address, length);
+    cmdline_start_job(digest_job_step);
 }
 
-static void unknown_command(char c)
+/**
+ * The source test's data: byte n of its stream is always n & 0xFF, so the
+ * host can check what it receives. Sent in place, like a raw dump, so the
+ * test measures the link rather than our copying.
+ */
+static uint8_t test_pattern[256];
+
+/**
+ * The state of the link test in progress, if any.
+ */
+static struct {
+    uint32_t remaining;
+    uint32_t received;
+    uint32_t start;
+} link_test;
+
+static bool test_source_step(void)
 {
-    console_puts("Unknown command (0x");
-    dump_byte(c);
-    console_puts(")!\r\n");
+    while(link_test.remaining) {
+        size_t chunk = sizeof(test_pattern);
+
+        if(chunk > link_test.remaining)
+            chunk = link_test.remaining;
+
+        // Wait for the transmit path to catch up, if its queue is full.
+        if(!tx_queue_memory(test_pattern, chunk))
+            return false;
+
+        link_test.remaining -= chunk;
+    }
+
+    return true;
+}
+
+static bool test_sink_step(void)
+{
+    uint8_t buf[MAX_PACKET_SIZE];
+    size_t len;
+
+    while(link_test.remaining) {
+        len = sizeof(buf);
+        if(len > link_test.remaining)
+            len = link_test.remaining;
+
+        len = cmdline_read_raw(buf, len);
+        if(!len)
+            return false;
+
+        // Time from the first data we see, so the command itself isn't counted.
+        if(!link_test.received)
+            link_test.start = dwt_read_cycle_counter();
+
+        link_test.received += len;
+        link_test.remaining -= len;
+    }
+
+    console_puts("sink: ");
+    dump_long(link_test.received);
+    console_puts(" bytes in ");
+    dump_long(dwt_read_cycle_counter() - link_test.start);
+    console_puts(" cycles\r\n");
+    return true;
+}
+
+static bool test_echo_step(void)
+{
+    uint8_t buf[MAX_PACKET_SIZE];
+
+    // Only take what we know we can send straight back.
+    if(console_bytes_free() < sizeof(buf))
+        return false;
+
+    console_write(buf, cmdline_read_raw(buf, sizeof(buf)));
+    return false;
+}
+
+#define LINK_TEST_USAGE "t source|sink bytes, or t echo: USB link self-tests; see usb_selftest.py"
+
+/**
+ * Exercises the USB link for the host to time: source streams a test
+ * pattern, sink consumes (and counts) data from the host, and echo sends
+ * everything it receives straight back until cancelled.
+ */
+static void command_link_test(int argc, char **argv)
+{
+    uint32_t length = 0;
+
+    if(argc == 2 && cmdline_matches("echo", argv[1])) {
+        cmdline_start_job(test_echo_step);
+        return;
+    }
+
+    if(argc != 3 || !cmdline_parse_u32(argv[2], &length)) {
+        usage_error(LINK_TEST_USAGE);
+        return;
+    }
+
+    link_test.remaining = length;
+    link_test.received = 0;
+
+    if(cmdline_matches("source", argv[1])) {
+        for(size_t i = 0; i < sizeof(test_pattern); ++i)
+            test_pattern[i] = i;
+
+        cmdline_start_job(test_source_step);
+    } else if(cmdline_matches("sink", argv[1])) {
+        // The host's data is arbitrary, cancel characters and all.
+        cmdline_expect_raw(length);
+        cmdline_start_job(test_sink_step);
+    } else {
+        usage_error(LINK_TEST_USAGE);
+    }
+}
+
+static bool capture_job_step(void)
+{
+    capture_step();
+    return false;
+}
+
+#define CAPTURE_USAGE "a [port rate [mask]]: stream a GPIO port (A-E) until Ctrl-C; alone, capture stats; see la_capture.py"
+
+static void report_capture_stats(void)
+{
+    const struct capture_stats *stats = capture_get_stats();
+
+    console_puts("capture: rate ");
+    dump_long(stats->rate);
+    console_puts(" samples ");
+    dump_long(stats->samples_sent);
+    console_puts(" bytes ");
+    dump_long(stats->bytes_sent);
+    console_puts(" overflows ");
+    dump_long(stats->overflows);
+    console_puts(" lost ");
+    dump_long(stats->samples_lost);
+    console_puts(" encode cycles ");
+    dump_long(stats->encode_cycles);
+    console_puts("\r\n");
+}
+
+/**
+ * Starts a logic analyzer capture of one GPIO port; see capture.h.
+ */
+static void command_capture(int argc, char **argv)
+{
+    static const uint32_t ports[] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE };
+    uint32_t rate, mask = 0xFFFF;
+    char letter;
+
+    if(argc == 1) {
+        report_capture_stats();
+        return;
+    }
+
+    if(argc < 3 || argc > 4 || argv[1][1] || !cmdline_parse_u32(argv[2], &rate) ||
+            (argc == 4 && !cmdline_parse_u32(argv[3], &mask))) {
+        usage_error(CAPTURE_USAGE);
+        return;
+    }
+
+    letter = argv[1][0] & ~0x20;
+    if(letter < 'A' || letter > 'E') {
+        usage_error(CAPTURE_USAGE);
+        return;
+    }
+
+    capture_start(ports[letter - 'A'], letter, rate, mask);
+    cmdline_start_cancellable_job(capture_job_step, capture_stop);
+}
+
+static bool profile_job_step(void)
+{
+    profile_step();
+    return false;
+}
+
+#define PROFILE_USAGE "p [rate]: sample the PC at rate Hz until Ctrl-C; alone, profiler stats; see profile.py"
+
+static void report_profile_stats(void)
+{
+    const struct profile_stats *stats = profile_get_stats();
+
+    console_puts("profile: rate ");
+    dump_long(stats->rate);
+    console_puts(" samples ");
+    dump_long(stats->samples_sent);
+    console_puts(" dropped ");
+    dump_long(stats->samples_dropped);
+    console_puts("\r\n");
+}
+
+/**
+ * Starts sampling the PC for a statistical profile; see profile.h.
+ */
+static void command_profile(int argc, char **argv)
+{
+    uint32_t rate;
+
+    if(argc == 1) {
+        report_profile_stats();
+        return;
+    }
+
+    if(argc != 2 || !cmdline_parse_u32(argv[1], &rate)) {
+        usage_error(PROFILE_USAGE);
+        return;
+    }
+
+    profile_start(rate);
+    cmdline_start_cancellable_job(profile_job_step, profile_stop);
+}
+
+static bool thermal_job_step(void)
+{
+    thermal_step();
+    return false;
+}
+
+#define THERMAL_USAGE "f [rate]: stream synthetic thermal frames at rate fps until Ctrl-C; alone, frame stats; see thermal_rx.py"
+
+static void report_thermal_stats(void)
+{
+    const struct thermal_stats *stats = thermal_get_stats();
+
+    console_puts("frames: line_rate ");
+    dump_long(stats->line_rate);
+    console_puts(" sent ");
+    dump_long(stats->frames_sent);
+    console_puts(" bytes ");
+    dump_long(stats->bytes_sent);
+    console_puts(" dropped ");
+    dump_long(stats->frames_dropped);
+    console_puts("\r\n");
+}
+
+/**
+ * Starts streaming thermal frames; see thermal.h.
+ */
+static void command_thermal(int argc, char **argv)
+{
+    uint32_t rate;
+
+    if(argc == 1) {
+        report_thermal_stats();
+        return;
+    }
+
+    if(argc != 2 || !cmdline_parse_u32(argv[1], &rate)) {
+        usage_error(THERMAL_USAGE);
+        return;
+    }
+
+    thermal_start(rate);
+    cmdline_start_cancellable_job(thermal_job_step, thermal_stop);
+}
+
+#define INSTRUMENT_USAGE "i [reset]: cycle counts for instrumented code (needs INSTRUMENT=1), or clear them"
+
+/**
+ * Reports the cycle counts for each instrumented region; see instrument.h.
+ */
+static void command_instrument(int argc, char **argv)
+{
+    if(argc == 2 && cmdline_matches("reset", argv[1])) {
+        instrument_reset();
+        return;
+    }
+
+    if(argc != 1) {
+        usage_error(INSTRUMENT_USAGE);
+        return;
+    }
+
+    if(!INSTRUMENT_ENABLED) {
+        console_puts("Built without instrumentation; rebuild with INSTRUMENT=1.\r\n");
+        return;
+    }
+
+    for(const struct instrument_region *region = instrument_first(); region; region = region->next) {
+
+        // Printing is itself instrumented, so take a consistent copy first.
+        uint32_t was_masked = cm_mask_interrupts(1);
+        struct instrument_region snapshot = *region;
+        cm_mask_interrupts(was_masked);
+
+        console_puts(snapshot.name);
+        console_puts(": calls ");
+        dump_long(snapshot.calls);
+        console_puts(" min ");
+        dump_long(snapshot.min_cycles);
+        console_puts(" max ");
+        dump_long(snapshot.max_cycles);
+        console_puts(" total ");
+        dump_long(snapshot.total_cycles >> 32);
+        dump_long(snapshot.total_cycles);
+        console_puts("\r\n");
+    }
+}
+
+/**
+ * Reports how long it took after reset for us to connect to the host, and
+ * for it to configure us.
+ */
+static void command_startup(int argc, char **argv)
+{
+    const struct usb_connect_times *times = usb_connect_get_times();
+
+    (void)argc;
+    (void)argv;
+
+    console_puts("startup: pullup ");
+    dump_long(times->pullup_ms);
+    console_puts(" configured ");
+    dump_long(times->configured_ms);
+    console_puts("\r\n");
+}
+
+/**
+ * Prints the event trace, oldest first; see trace.h.
+ */
+static void command_trace(int argc, char **argv)
+{
+    struct trace_record records[TRACE_RECORDS];
+    size_t count = trace_read(records, TRACE_RECORDS);
+
+    (void)argc;
+    (void)argv;
+
+    for(size_t i = 0; i < count; ++i) {
+        console_puts("trace: seq ");
+        dump_long(records[i].sequence);
+        console_puts(" ms ");
+        dump_long(records[i].timestamp_ms);
+        console_puts(" event ");
+        dump_long(records[i].event);
+        console_puts(" a ");
+        dump_long(records[i].a);
+        console_puts(" b ");
+        dump_long(records[i].b);
+        console_puts("\r\n");
+    }
+}
+
+#define RESET_USAGE "r [dfu]: reset device, or reboot straight into the DFU bootloader"
+
+static void command_reset(int argc, char **argv)
+{
+    if(argc == 1) {
+        trace(TRACE_RESET, TRACE_RESET_COMMAND, 0);
+        scb_reset_system();
+    }
+
+    if(argc == 2 && cmdline_matches("dfu", argv[1])) {
+        trace(TRACE_RESET, TRACE_RESET_COMMAND, BOOT_REQUEST_ALT_BOOTLOADER);
+        boot_request_reset(BOOT_REQUEST_ALT_BOOTLOADER);
+    }
+
+    usage_error(RESET_USAGE);
 }
 
 /**
@@ -362,77 +1322,144 @@ static void unknown_command(char c)
  * Useful for identifying the GPIO pins coresponding to a given button
  * with the case closed.
  */
-static void read_back_gpio(void)
+static void command_gpio(int argc, char **argv)
 {
-    console_puts("Port ");
+    (void)argc;
+    (void)argv;
 
-    uint32_t gpioports[] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE };
-    size_t num_gpio = (sizeof(gpioports) / sizeof(gpioports[0]));
+    LOG("Port A: %08X B: %08X C: %08X D: %08X E: %08X\r\n",
+            gpio_port_read(GPIOA), gpio_port_read(GPIOB), gpio_port_read(GPIOC),
+            gpio_port_read(GPIOD), gpio_port_read(GPIOE));
+}
 
-    // Read back each of our GPIO ports.
-    for(size_t i = 0; i < num_gpio; ++i) {
-        console_putc('A' + i );
-        console_puts(": ");
-        dump_long(gpio_port_read(gpioports[i]));
-        console_putc(' ');
-    }
+/**
+ * Folds the cycles spent awake since the last sample into active_cycles.
+ */
+static void sample_cpu_usage(void)
+{
+    uint32_t now = dwt_read_cycle_counter();
 
-    console_puts("\r\n");
+    active_cycles += now - last_cycle_count;
+    last_cycle_count = now;
 }
 
-static void print_help(void) {
-    console_puts("d: dump bootloader\r\n");
-    console_puts("r: reset device\r\n");
-    console_puts("g: read all GPIO\r\n");
-    console_puts("h: this help message\r\n");
-    console_puts("\r\n");
+/**
+ * Reports the share of time the CPU has been awake since the last report,
+ * in tenths of a percent. This is always 100% when polling USB.
+ */
+static void report_cpu_usage(void)
+{
+    static uint32_t window_start_ms;
+    static uint64_t window_start_cycles;
+
+    sample_cpu_usage();
+
+    uint32_t now_ms = timebase_now_ms();
+    uint64_t now_cycles = active_cycles;
+
+    uint64_t window_cycles = (uint64_t)(now_ms - window_start_ms) * (rcc_ahb_frequency / 1000);
+    uint32_t permille = window_cycles ? (now_cycles - window_start_cycles) * 1000 / window_cycles : 0;
+
+    LOG("cpu: %u.%u%% active over %u ms\r\n", permille / 10, permille % 10, now_ms - window_start_ms);
+
+    window_start_ms = now_ms;
+    window_start_cycles = now_cycles;
 }
 
-static void handle_command(char c)
+/**
+ * Reports how well the console has been keeping up with the host, what
+ * compressing dumps has cost and saved, what logging costs, and how busy the
+ * CPU has been.
+ */
+#define STATS_USAGE "s [reset]: console, dump, log and CPU statistics, or clear the console's and log's"
+
+static void command_stats(int argc, char **argv)
 {
-    switch(c) {
-        case 'd':
-        case 'D':
-          dump_bootloader();
-          return;
-        case 'r':
-        case 'R':
-          scb_reset_system();
-          return;
-        case 'g':
-        case 'G':
-          read_back_gpio();
-          return;
-        case 'h':
-        case 'H':
-          print_help();
-          return;
-        case 0x0D: // enter
-          return;
-        default:
-          unknown_command(c);
-          return;
+    if(argc == 2 && cmdline_matches("reset", argv[1])) {
+        console_reset_stats();
+        log_reset_stats();
+        rx_callback_max_cycles = 0;
+        return;
+    }
+
+    if(argc != 1) {
+        usage_error(STATS_USAGE);
+        return;
     }
+
+    const struct console_stats *stats = console_get_stats();
+    const struct bindump_stats *dump_stats = bindump_get_stats();
+
+    LOG("dropped: %08X overwritten: %08X stalls: %08X timeouts: %08X max wait ms: %08X "
+            "free: %08X rx callback max cycles: %08X\r\n",
+            stats->dropped_bytes, stats->overwritten_bytes, stats->stalls,
+            stats->timeouts, stats->max_wait_ms, console_bytes_free(),
+            rx_callback_max_cycles);
+
+    // How much of the time since the last report we've spent awake.
+    report_cpu_usage();
+
+    // Compression's cost per byte, and what it's saved us.
+    LOG("compressed: %08X bytes as %08X in %08X cycles; %08X cycles per byte\r\n",
+            dump_stats->raw_bytes, dump_stats->sent_bytes, dump_stats->compress_cycles,
+            dump_stats->raw_bytes ? dump_stats->compress_cycles / dump_stats->raw_bytes : 0);
+
+#if EXTRACTOR_LOG_DEFERRED
+    // What LOG() itself costs each caller; copied first, as this LOG() adds to it.
+    struct log_stats log_stats = *log_get_stats();
+
+    LOG("log: %08X records, %08X dropped, %08X cycles max, %08X cycles average\r\n",
+            log_stats.records, log_stats.dropped, log_stats.max_cycles,
+            log_stats.records ? log_stats.total_cycles / log_stats.records : 0);
+#endif
 }
 
+static void command_help(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    cmdline_print_usage();
+}
+
+static const struct cmdline_command commands[] = {
+    { "d", DUMP_HEX_USAGE, command_dump_hex },
+    { "b", DUMP_BINARY_USAGE, command_dump_binary },
+    { "x", DUMP_RAW_USAGE, command_dump_raw },
+    { "c", DIGEST_USAGE, command_digest },
+    { "t", LINK_TEST_USAGE, command_link_test },
+    { "a", CAPTURE_USAGE, command_capture },
+    { "p", PROFILE_USAGE, command_profile },
+    { "f", THERMAL_USAGE, command_thermal },
+    { "i", INSTRUMENT_USAGE, command_instrument },
+    { "r", RESET_USAGE, command_reset },
+    { "g", "g: read all GPIO", command_gpio },
+    { "e", "e: events traced since, and from before, the last reset; see trace.py", command_trace },
+    { "u", "u: USB startup times, in ms since reset; see startup_bench.py", command_startup },
+    { "s", STATS_USAGE, command_stats },
+    { "h", "h: this help message", command_help },
+};
+
 /**
- * Called when the host has sent data to us.
+ * Called when the host has sent data to us. Commands are only queued here,
+ * and run later from the main loop, so this always returns quickly.
  */
 static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
 {
-  (void)ep;
+  uint32_t start = dwt_read_cycle_counter();
+  uint32_t elapsed;
 
-  char buf[MAX_PACKET_SIZE];
-  int len = usbd_ep_read_packet(usbd_dev, ep, buf, 64);
+  (void)ep;
 
-  // Perform a nullary write to the endpoint. This marks the relevant
-  // interrupt as serviced (and does not send a ZLP).
-  usbd_ep_write_packet(usbdev, 0x82, NULL, 0);
+#if EXTRACTOR_DBLBUF_OUT
+  usb_dblbuf_out_service(&data_out);
+#endif
+  receive_from_host(usbd_dev);
 
-  // Handle each command present in the relevant data.
-  for(int i = 0; i < len; ++i) {
-      handle_command(buf[i]);
-  }
+  // Keep track of our worst case, so it can be reported with the stats.
+  elapsed = dwt_read_cycle_counter() - start;
+  if(elapsed > rx_callback_max_cycles)
+    rx_callback_max_cycles = elapsed;
 }
 
 /**
@@ -440,40 +1467,45 @@ static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
  */
 static void cdcacm_tx_ready_cb(usbd_device *usbd_dev, uint8_t ep)
 {
-    (void)ep;
+    INSTRUMENT_BEGIN(cdcacm_tx_ready_cb);
 
-    size_t to_transmit = ringbuf_bytes_used(&console_buffer);
+#if EXTRACTOR_DBLBUF_IN
+    (void)ep;
 
+    // A packet's gone out, so we have a buffer to refill.
+    usb_dblbuf_in_service(&data_in, true);
+#else
     // Perform a nullary read from the endpoint; this marks the
     // relevant 'interrupt' as serviced.
     usbd_ep_read_packet(usbd_dev, ep, NULL, 0);
+#endif
 
-    // If we don't have any data to send, return without transmitting.
-    if(to_transmit == 0)
-        return;
-
-    // If we can't send this all in one packet, send as much as we can.
-    if(to_transmit > MAX_PACKET_SIZE)
-        to_transmit = MAX_PACKET_SIZE;
+    transmit_next_packet(usbd_dev);
 
-    // Get the data to be transmitted...
-    uint8_t buf[MAX_PACKET_SIZE];
-    ringbuf_memcpy_from(buf, &console_buffer, to_transmit);
-
-    //... and transmit it.
-    usbd_ep_write_packet(usbd_dev, 0x82, buf, to_transmit);
+    INSTRUMENT_END(cdcacm_tx_ready_cb);
 }
 
 
 
 static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue)
 {
-  (void)wValue;
+  usb_connect_configured();
+  trace(TRACE_USB_CONFIGURED, wValue, 0);
 
   usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK, MAX_PACKET_SIZE, cdcacm_data_rx_cb);
   usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, MAX_PACKET_SIZE, cdcacm_tx_ready_cb);
   usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
 
+#if EXTRACTOR_DBLBUF_OUT
+  usb_dblbuf_out_init(&data_out, 0x01, DATA_OUT_SECOND_BUFFER);
+#endif
+#if EXTRACTOR_DBLBUF_IN
+  usb_dblbuf_in_init(&data_in, 0x02, DATA_IN_SECOND_BUFFER);
+#endif
+
+  // The IN endpoint is now ready for the main loop to start transmitting.
+  tx_idle = true;
+
   usbd_register_control_callback(
         usbd_dev,
         USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
@@ -490,10 +1522,6 @@ static void setup_gpio(void)
     rcc_periph_clock_enable(RCC_GPIOC);
     rcc_periph_clock_enable(RCC_GPIOD);
     rcc_periph_clock_enable(RCC_GPIOE);
-
-    /// Start with the USB pull-up disabled, so we don't trigger a connection until we're ready.
-    gpio_set(GPIOE, GPIO0);
-    gpio_set_mode(GPIOE, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, GPIO0);
 }
 
 static bool power_button_pressed(void)
@@ -501,30 +1529,90 @@ static bool power_button_pressed(void)
     return !gpio_get(GPIOB, GPIO1);
 }
 
+/**
+ * Resets the device once the power button has been held for a while. Runs
+ * from the tick interrupt, so it works even if the main loop is stuck.
+ */
 static void handle_long_press(void) {
-    static size_t press_duration = 0;
+    static uint32_t press_duration_ms = 0;
 
     if(power_button_pressed()) {
-        ++press_duration;
+        ++press_duration_ms;
 
-        if(press_duration > LONG_PRESS_DURATION) {
+        if(press_duration_ms > LONG_PRESS_DURATION_MS) {
+          trace(TRACE_RESET, TRACE_RESET_LONG_PRESS, 0);
           scb_reset_system();
         }
     } else {
-        press_duration = 0;
+        press_duration_ms = 0;
     }
 }
 
+/**
+ * Starts our periodic work, and the tick's watch on the power button.
+ */
+static void setup_timers(void)
+{
+    last_cycle_count = dwt_read_cycle_counter();
+
+    timebase_set_tick_handler(handle_long_press);
+    sched_every(&cpu_usage_timer, sample_cpu_usage, CPU_USAGE_SAMPLE_MS);
+}
+
+/**
+ * @return True iff neither the console nor the scheduler has work for us.
+ */
+static bool main_loop_idle(void)
+{
+    return cmdline_idle() && sched_idle() && log_idle();
+}
+
+#if EXTRACTOR_USB_IRQ
+
+/*
+ * Completions on double-buffered bulk endpoints are signalled on the USB
+ * high-priority interrupt, and everything else on the low-priority one;
+ * either way, usbd_poll handles them.
+ */
+void usb_lp_can_rx0_isr(void)
+{
+    poll_usb();
+}
+
+void usb_hp_can_tx_isr(void)
+{
+    poll_usb();
+}
+
+#endif
+
 
 int main(void)
 {
+    // Start the timebase straight away, so our startup is timed from reset,
+    // and keep the USB pull-up off until we're ready for the host.
+    timebase_init();
+    usb_connect_init();
+
+    // Pick up the event trace from before the reset, and note this boot in it.
+    trace_init(TRACE_PROGRAM_EXTRACTOR);
+
     // Set up use of the system's external crystal, as the 103VE series requires
     // an external crystal to drive the USB PLL.
     rcc_clock_setup_in_hse_8mhz_out_72mhz();
+    timebase_init();
 
     // Set up our GPIO and console.
     setup_gpio();
-    ringbuf_init(&console_buffer, raw_buffer, sizeof(raw_buffer));
+    console_init(wait_for_host);
+    console_set_overwrite_handler(tx_queue_overwritten);
+    cmdline_init(commands, sizeof(commands) / sizeof(commands[0]));
+    log_init();
+
+    // Start the cycle counter, which we use to time our USB callbacks, and
+    // our periodic work.
+    dwt_enable_cycle_counter();
+    setup_timers();
 
     // Enable clocking for the resources we'll be using.
     rcc_periph_clock_enable(RCC_AFIO);
@@ -534,19 +1622,28 @@ int main(void)
     AFIO_MAPR |= AFIO_MAPR_SWJ_CFG_JTAG_OFF_SW_ON;
 
     // Start up our USB device controller...
-    usbdev = usbd_init(&st_usbfs_v1_usb_driver, &dev, &config, usb_strings, 3, usbd_control_buffer, sizeof(usbd_control_buffer));
+    usbdev = usbd_init(&st_usbfs_v1_usb_driver, &dev, &config, usb_strings, 4, usbd_control_buffer, sizeof(usbd_control_buffer));
     usbd_register_set_config_callback(usbdev, cdcacm_set_config);
 
+#if EXTRACTOR_USB_IRQ
+    nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, USB_IRQ_PRIORITY);
+    nvic_set_priority(NVIC_USB_HP_CAN_TX_IRQ, USB_IRQ_PRIORITY);
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    nvic_enable_irq(NVIC_USB_HP_CAN_TX_IRQ);
+#endif
 
-    // Waiting a moment seems to prevent itermittant enumeration issues.
-    for (int i = 0; i < 800000; i++)
-      __asm__("nop");
-
-    // Finally, turn on the USB pull-up to signal that we're ready to connect.
-    gpio_clear(GPIOE, GPIO0);
+    // Finally, turn on the USB pull-up to signal that we're ready to connect,
+    // once the host has had time to see us disconnect.
+    usb_connect();
 
     while (1) {
-        handle_long_press();
-        usbd_poll(usbdev);
+        cmdline_poll();
+        sched_run();
+        log_flush();
+        service_usb();
+
+        // Nothing to do until the host sends us something, or a timer's due;
+        // the tick wakes us every millisecond to check.
+        sleep_while_idle(main_loop_idle);
     }
 }
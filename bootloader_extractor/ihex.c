@@ -0,0 +1,75 @@
+/*
+ * Intel HEX record encoding for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ihex.h"
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+/**
+ * Writes a byte as two hex digits, and adds it to a running checksum.
+ */
+static inline char *encode_byte(char *dest, uint8_t byte, uint8_t *checksum)
+{
+    dest[0] = hex_digits[byte >> 4];
+    dest[1] = hex_digits[byte & 0xF];
+    *checksum += byte;
+
+    return dest + 2;
+}
+
+
+size_t ihex_encode_record(char *dest, uint8_t type, uint16_t address,
+        const uint8_t *data, uint8_t length)
+{
+    char *pos = dest;
+    uint8_t checksum = 0;
+
+    *pos++ = ':';
+    pos = encode_byte(pos, length, &checksum);
+    pos = encode_byte(pos, address >> 8, &checksum);
+    pos = encode_byte(pos, address & 0xFF, &checksum);
+    pos = encode_byte(pos, type, &checksum);
+
+    for(uint8_t i = 0; i < length; ++i)
+        pos = encode_byte(pos, data[i], &checksum);
+
+    pos = encode_byte(pos, ~checksum + 1, &checksum);
+    *pos++ = '\r';
+    *pos++ = '\n';
+
+    return pos - dest;
+}
+
+size_t ihex_encode_data(char *dest, uint32_t offset, const uint8_t *data,
+        uint8_t length, uint16_t *upper)
+{
+    size_t written = 0;
+
+    // If we've moved into a new 64KiB window, say so first.
+    if((offset >> 16) != *upper) {
+        uint8_t segment[2];
+
+        *upper = offset >> 16;
+        segment[0] = *upper >> 8;
+        segment[1] = *upper & 0xFF;
+
+        written = ihex_encode_record(dest, IHEX_EXTENDED_LINEAR_ADDRESS, 0, segment, 2);
+    }
+
+    return written + ihex_encode_record(dest + written, IHEX_DATA, offset & 0xFFFF, data, length);
+}
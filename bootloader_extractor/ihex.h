@@ -0,0 +1,70 @@
+/*
+ * Intel HEX record encoding for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IHEX_H__
+#define __IHEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Intel HEX record types.
+ */
+enum ihex_record_type {
+    IHEX_DATA = 0x00,
+    IHEX_END_OF_FILE = 0x01,
+    IHEX_EXTENDED_LINEAR_ADDRESS = 0x04,
+};
+
+// The most data bytes we'll put in a single record.
+#define IHEX_MAX_DATA (16)
+
+// The length of an encoded record carrying length data bytes:
+// the start code, count, address, type, data, checksum, and CRLF.
+#define IHEX_RECORD_SIZE(length) (1 + 2 + 4 + 2 + (2 * (length)) + 2 + 2)
+
+// The most room ihex_encode_data can need for a single call.
+#define IHEX_MAX_ENCODED_SIZE (IHEX_RECORD_SIZE(IHEX_MAX_DATA) + IHEX_RECORD_SIZE(2))
+
+#define IHEX_EOF_RECORD ":00000001FF\r\n"
+
+/**
+ * Encodes a single record into dest, which must have room for
+ * IHEX_RECORD_SIZE(length) characters. The checksum is computed in the
+ * same pass.
+ *
+ * @return The number of characters written.
+ */
+size_t ihex_encode_record(char *dest, uint8_t type, uint16_t address,
+        const uint8_t *data, uint8_t length);
+
+/**
+ * Encodes a data record for the given 32-bit offset into dest, preceded by
+ * an extended linear address record if the offset's upper 16 bits differ
+ * from *upper (which is then updated). Start *upper at zero, as that's what
+ * a reader assumes before the first extended address record.
+ *
+ * Records can't cross a 64KiB boundary; it's up to the caller to split
+ * data at those boundaries.
+ *
+ * @return The number of characters written; at most IHEX_MAX_ENCODED_SIZE.
+ */
+size_t ihex_encode_data(char *dest, uint32_t offset, const uint8_t *data,
+        uint8_t length, uint16_t *upper);
+
+#endif
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+Reads the cycle counts from firmware built with INSTRUMENT=1.
+
+From the extractor, these come from its 'i' command; from the DFU bootloader,
+from a vendor request (which needs pyusb). Either way, each instrumented
+region is printed as a line of key=value pairs, so runs of different builds
+can be compared with diff. See instrument.h in the firmware.
+"""
+
+import struct
+import sys
+
+DFU_ID                   = (0x0483, 0xdf11)
+
+# The DFU bootloader's vendor requests; see usbdfu.c.
+REQUEST_INSTRUMENT_READ  = 0x01
+REQUEST_INSTRUMENT_RESET = 0x02
+VENDOR_IN                = 0xC0
+VENDOR_OUT               = 0x40
+MAX_READ                 = 1024
+
+RECORD                   = struct.Struct('<IIIQ')
+
+
+def parse_records(data):
+    """
+    Unpacks the statistics sent by the DFU bootloader.
+
+    return: A list of (name, calls, min, max, total) tuples.
+    """
+
+    regions = []
+    pos = 0
+
+    while pos + RECORD.size < len(data):
+        calls, min_cycles, max_cycles, total_cycles = RECORD.unpack_from(data, pos)
+        end = data.index(b'\0', pos + RECORD.size)
+        name = data[pos + RECORD.size:end].decode(errors='replace')
+
+        regions.append((name, calls, min_cycles, max_cycles, total_cycles))
+        pos = end + 1
+
+    return regions
+
+
+def read_dfu(reset):
+    """
+    Reads (or clears) the statistics from the DFU bootloader.
+    """
+
+    import usb.core
+
+    dev = usb.core.find(idVendor=DFU_ID[0], idProduct=DFU_ID[1])
+    if dev is None:
+        raise IOError("no DFU bootloader attached")
+
+    # Our requests are only handled once the device is configured.
+    try:
+        dev.get_active_configuration()
+    except usb.core.USBError:
+        dev.set_configuration()
+
+    if reset:
+        dev.ctrl_transfer(VENDOR_OUT, REQUEST_INSTRUMENT_RESET, 0, 0)
+        return []
+
+    return parse_records(bytes(dev.ctrl_transfer(VENDOR_IN, REQUEST_INSTRUMENT_READ, 0, 0, MAX_READ)))
+
+
+def read_extractor(serial_port, reset):
+    """
+    Reads (or clears) the statistics from the extractor.
+    """
+
+    from serial import Serial
+
+    sp = Serial(serial_port, timeout=0.5)
+    sp.reset_input_buffer()
+    sp.write(b'i reset\r' if reset else b'i\r')
+
+    regions = []
+    while True:
+        line = sp.readline().decode(errors='replace').strip()
+        if not line:
+            break
+
+        # "name: calls X min X max X total X", all in hex.
+        name, _, rest = line.partition(': ')
+        words = rest.split()
+        if name.startswith('Built without'):
+            raise IOError(line)
+        if len(words) != 8:
+            continue
+
+        values = {key: int(value, 16) for key, value in zip(words[0::2], words[1::2])}
+        regions.append((name, values['calls'], values['min'], values['max'], values['total']))
+
+    return regions
+
+
+def usage():
+    print("usage: {} <serial_port>|dfu [reset]".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) not in (2, 3) or (len(sys.argv) == 3 and sys.argv[2] != 'reset'):
+        usage()
+        sys.exit(0)
+
+    reset = len(sys.argv) == 3
+
+    if sys.argv[1] == 'dfu':
+        regions = read_dfu(reset)
+    else:
+        regions = read_extractor(sys.argv[1], reset)
+
+    for name, calls, min_cycles, max_cycles, total_cycles in regions:
+        print("bench=instrument region={} calls={} min_cycles={} max_cycles={} avg_cycles={:.1f} total_cycles={}".format(
+            name, calls, min_cycles, max_cycles, total_cycles / calls if calls else 0, total_cycles))
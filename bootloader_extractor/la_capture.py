@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""
+Captures a GPIO port with the extractor's logic analyzer mode ('a').
+
+Writes the capture as a VCD file, which most waveform viewers (and sigrok,
+via its VCD input) can open. The sweep mode instead captures briefly at
+increasing rates, and reports the fastest one the device kept up with.
+See capture.h in the firmware for the stream format.
+"""
+
+import struct
+import sys
+import time
+
+from serial import Serial
+
+from rx_bootloader import read_frame
+
+FRAME_CAPTURE_START = 0x05
+FRAME_SAMPLES       = 0x06
+
+CAPTURE_START       = struct.Struct('<IHcx')
+
+CANCEL              = b'\x03'
+
+# The rates tried by a sweep, and how long each is given.
+SWEEP_RATES         = [10000, 20000, 50000, 100000, 200000, 500000,
+                       1000000, 2000000, 4000000]
+SWEEP_SECONDS       = 1.0
+
+
+def decode_runs(payload):
+    """
+    Splits a SAMPLES frame's payload into its runs.
+
+    return: A list of (value, length) tuples.
+    """
+
+    runs = []
+    pos = 0
+
+    while pos + 2 <= len(payload):
+        value, = struct.unpack_from('<H', payload, pos)
+        pos += 2
+
+        # Each run's length follows as a LEB128 varint.
+        length = shift = 0
+        while True:
+            byte = payload[pos]
+            pos += 1
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+
+        runs.append((value, length))
+
+    return runs
+
+
+class Capture:
+    """
+    The samples received from a single capture, kept as a list of changes;
+    a value of None marks the start of samples that were lost.
+    """
+
+    def __init__(self):
+        self.rate = None
+        self.mask = 0xFFFF
+        self.port = '?'
+        self.changes = []
+        self.samples = 0
+        self.lost = 0
+        self.gaps = 0
+        self._next_index = 0
+        self._last_value = None
+
+    def add_frame(self, frame_type, address, payload):
+        if frame_type == FRAME_CAPTURE_START:
+            self.rate, self.mask, port = CAPTURE_START.unpack(payload[:CAPTURE_START.size])
+            self.port = port.decode()
+            return
+
+        if frame_type != FRAME_SAMPLES or self.rate is None:
+            return
+
+        # Sample indices are 32 bits on the wire; extend them, and notice gaps.
+        index = (self._next_index & ~0xFFFFFFFF) | address
+        if index < self._next_index:
+            index += 1 << 32
+
+        # Mark lost samples as unknown, rather than showing the last value held.
+        if index != self._next_index:
+            self.gaps += 1
+            self.lost += index - self._next_index
+            self.changes.append((self._next_index, None))
+            self._last_value = None
+
+        start = index
+        for value, length in decode_runs(payload):
+            if value != self._last_value:
+                self.changes.append((index, value))
+                self._last_value = value
+            index += length
+
+        self.samples += index - start
+        self._next_index = index
+
+    def write_vcd(self, filename):
+        pins = [pin for pin in range(16) if self.mask & (1 << pin)]
+        ids = {pin: chr(33 + pin) for pin in pins}
+        last = None
+
+        with open(filename, 'w') as f:
+            f.write('$comment TG165 extractor capture of port {} at {} Hz $end\n'.format(self.port, self.rate))
+            f.write('$timescale 1 ns $end\n')
+            f.write('$scope module P{} $end\n'.format(self.port))
+            for pin in pins:
+                f.write('$var wire 1 {} P{}{} $end\n'.format(ids[pin], self.port, pin))
+            f.write('$upscope $end\n$enddefinitions $end\n')
+
+            for index, value in self.changes:
+                f.write('#{}\n'.format(index * 1000000000 // self.rate))
+                for pin in pins:
+                    if value is None:
+                        f.write('x{}\n'.format(ids[pin]))
+                    elif last is None or (value ^ last) & (1 << pin):
+                        f.write('{}{}\n'.format((value >> pin) & 1, ids[pin]))
+                last = value
+
+            f.write('#{}\n'.format(self._next_index * 1000000000 // self.rate))
+
+
+def device_stats(sp):
+    """
+    Asks the device for its statistics on the last capture.
+
+    return: A dictionary of the values it reported.
+    """
+
+    sp.reset_input_buffer()
+    sp.write(b'a\r')
+
+    words = sp.readline().decode(errors='replace').split()
+    if not words or words[0] != 'capture:':
+        raise IOError("unexpected reply from device: {!r}".format(' '.join(words)))
+
+    # Pairs of names and hex values; 'encode cycles' is two words.
+    words = words[1:]
+    words = words[:-3] + ['encode_cycles', words[-1]]
+    return {name: int(value, 16) for name, value in zip(words[0::2], words[1::2])}
+
+
+def capture(sp, port, rate, seconds, mask):
+    """
+    Captures the given port for the given time.
+
+    return: A (Capture, device statistics) tuple.
+    """
+
+    result = Capture()
+
+    sp.write(CANCEL + b'\r')
+    time.sleep(0.1)
+    sp.reset_input_buffer()
+
+    sp.write('a {} {} 0x{:x}\r'.format(port, rate, mask).encode())
+
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        if payload is not None:
+            result.add_frame(frame_type, address, payload)
+
+    # Stop the capture, and take whatever's still on its way.
+    sp.write(CANCEL)
+    while True:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        if payload is not None:
+            result.add_frame(frame_type, address, payload)
+
+    return (result, device_stats(sp))
+
+
+def sweep(sp, port, mask):
+    best = None
+
+    for rate in SWEEP_RATES:
+        result, stats = capture(sp, port, rate, SWEEP_SECONDS, mask)
+        cycles_per_sample = stats['encode_cycles'] / stats['samples'] if stats['samples'] else 0
+
+        print("bench=la_sweep port={} rate={} samples={} overflows={} lost={} encode_cycles_per_sample={:.1f}".format(
+            port, stats['rate'], stats['samples'], stats['overflows'], stats['lost'], cycles_per_sample))
+
+        if stats['overflows']:
+            break
+        best = stats['rate']
+
+    print("bench=la_sweep port={} max_sustainable_rate={}".format(port, best or 0))
+
+
+def usage():
+    print("usage: {} <serial_port> <gpio_port> <rate> <seconds> <vcd_filename> [mask]".format(sys.argv[0]))
+    print("       {} <serial_port> <gpio_port> sweep [mask]".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) in (4, 5) and sys.argv[3] == 'sweep':
+        sp = Serial(sys.argv[1], timeout=1)
+        sweep(sp, sys.argv[2].upper(), int(sys.argv[4], 0) if len(sys.argv) == 5 else 0xFFFF)
+        sys.exit(0)
+
+    if len(sys.argv) not in (6, 7):
+        usage()
+        sys.exit(0)
+
+    sp = Serial(sys.argv[1], timeout=1)
+    port = sys.argv[2].upper()
+    mask = int(sys.argv[6], 0) if len(sys.argv) == 7 else 0xFFFF
+
+    result, stats = capture(sp, port, int(sys.argv[3], 0), float(sys.argv[4]), mask)
+    result.write_vcd(sys.argv[5])
+
+    print("bench=la_capture port={} rate={} samples={} changes={} overflows={} lost={}".format(
+        port, result.rate, stats['samples'], len(result.changes), stats['overflows'], stats['lost']))
@@ -0,0 +1,224 @@
+/*
+ * Deferred-formatting diagnostic logging for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "console.h"
+#include "log.h"
+
+#if EXTRACTOR_LOG_DEFERRED
+
+#include <stddef.h>
+#include <string.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "bindump.h"
+#include "ringbuf_spsc.h"
+
+// Room for a couple of dozen typical records; must be a power of two.
+#define LOG_QUEUE_SIZE (1024)
+
+/**
+ * A record as it waits in the queue; only the arguments actually passed
+ * are stored.
+ */
+struct log_entry {
+    uint16_t id;
+    uint16_t sequence;
+    uint8_t count;
+    uint32_t args[LOG_MAX_ARGS];
+};
+
+#define LOG_ENTRY_HEADER_SIZE (offsetof(struct log_entry, args))
+
+static uint8_t queue_storage[LOG_QUEUE_SIZE];
+static struct ringbuf_spsc_t queue;
+
+static uint16_t sequence;
+static struct log_stats stats;
+
+void log_init(void)
+{
+    ringbuf_spsc_init(&queue, queue_storage, sizeof(queue_storage));
+}
+
+void log_record(uint16_t id, const uint32_t *args, uint32_t count)
+{
+    uint32_t start = dwt_read_cycle_counter();
+    struct log_entry entry;
+    size_t size;
+
+    if(count > LOG_MAX_ARGS)
+        count = LOG_MAX_ARGS;
+
+    // Every record takes a sequence number, so the host can tell if any
+    // were dropped.
+    entry.id = id;
+    entry.sequence = sequence++;
+    entry.count = count;
+    memcpy(entry.args, args, count * sizeof(uint32_t));
+    size = LOG_ENTRY_HEADER_SIZE + count * sizeof(uint32_t);
+
+    if(ringbuf_spsc_bytes_free(&queue) >= size)
+        ringbuf_spsc_memcpy_into(&queue, &entry, size);
+    else
+        ++stats.dropped;
+
+    uint32_t cycles = dwt_read_cycle_counter() - start;
+    ++stats.records;
+    stats.total_cycles += cycles;
+    if(cycles > stats.max_cycles)
+        stats.max_cycles = cycles;
+}
+
+void log_flush(void)
+{
+    // The largest frame a record can need, so we never wait for the console.
+    const size_t frame_size = BINDUMP_HEADER_SIZE + LOG_MAX_ARGS * sizeof(uint32_t) +
+        BINDUMP_TRAILER_SIZE;
+    struct log_entry entry;
+
+    while(!log_idle() && console_bytes_free() >= frame_size) {
+        ringbuf_spsc_memcpy_from(&entry, &queue, LOG_ENTRY_HEADER_SIZE);
+        ringbuf_spsc_memcpy_from(entry.args, &queue, entry.count * sizeof(uint32_t));
+
+        // We're little-endian, just like the record, so the arguments go as-is.
+        bindump_send_frame(BINDUMP_FRAME_LOG, entry.sequence, entry.id, entry.args,
+                entry.count * sizeof(uint32_t));
+    }
+}
+
+bool log_idle(void)
+{
+    return ringbuf_spsc_is_empty(&queue);
+}
+
+const struct log_stats *log_get_stats(void)
+{
+    return &stats;
+}
+
+void log_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+#else
+
+// How much formatted text we build up before queueing it on the console.
+#define LOG_LINE_SIZE (64)
+
+/**
+ * Adds text to the line being formatted, flushing it to the console
+ * whenever it fills.
+ */
+static void append(char *line, size_t *len, const char *text, size_t text_len)
+{
+    while(text_len--) {
+        if(*len == LOG_LINE_SIZE) {
+            console_write(line, *len);
+            *len = 0;
+        }
+        line[(*len)++] = *text++;
+    }
+}
+
+/**
+ * Formats a number into the end of a buffer, returning where it starts.
+ */
+static char *format_number(char *end, uint32_t value, uint32_t base,
+        const char *digits, int width, char pad)
+{
+    char *pos = end;
+
+    do {
+        *--pos = digits[value % base];
+        value /= base;
+        --width;
+    } while(value);
+
+    while(width-- > 0)
+        *--pos = pad;
+
+    return pos;
+}
+
+void log_format(const char *fmt, const uint32_t *args, uint32_t count)
+{
+    char line[LOG_LINE_SIZE];
+    size_t len = 0;
+
+    for(; *fmt; ++fmt) {
+        char number[16];
+        char *end = &number[sizeof(number)];
+        char *text;
+        char pad = ' ';
+        int width = 0;
+        uint32_t value;
+
+        if(*fmt != '%' || !fmt[1]) {
+            append(line, &len, fmt, 1);
+            continue;
+        }
+
+        // Parse the conversion's flags and width...
+        ++fmt;
+        if(*fmt == '0') {
+            pad = '0';
+            ++fmt;
+        }
+        while(*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (*fmt++ - '0');
+        if(width > (int)sizeof(number))
+            width = sizeof(number);
+
+        if(!*fmt)
+            break;
+        if(*fmt == '%' || !count) {
+            append(line, &len, fmt, 1);
+            continue;
+        }
+
+        // ... and convert the next argument.
+        value = *args++;
+        --count;
+
+        switch(*fmt) {
+            case 'x':
+                text = format_number(end, value, 16, "0123456789abcdef", width, pad);
+                break;
+            case 'X':
+                text = format_number(end, value, 16, "0123456789ABCDEF", width, pad);
+                break;
+            case 'u':
+                text = format_number(end, value, 10, "0123456789", width, pad);
+                break;
+            case 'c':
+                text = end - 1;
+                *text = value;
+                break;
+            default:
+                text = end;
+                break;
+        }
+
+        append(line, &len, text, end - text);
+    }
+
+    console_write(line, len);
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Deferred-formatting diagnostic logging for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Formatting text on the device is slow, and makes for twice as many bytes
+ * on the wire as the values being reported. Instead, LOG() leaves its format
+ * string in the ELF -- in the .log_strings section, which the linker script
+ * places at address zero and never loads -- and records just the string's ID
+ * and its arguments. Recording never blocks and does no framing: the record
+ * is copied into a small ring of its own, or counted as dropped if that's
+ * full, so LOG() costs a few dozen cycles wherever it's called from.
+ *
+ * log_flush(), from the main loop, later sends each record on the console as
+ * a BINDUMP_FRAME_LOG frame (see bindump.h), whenever there's room for it:
+ *
+ *   address: the string ID, the format string's address within .log_strings
+ *   sequence: counts up from zero at reset, one per record, dropped or not
+ *   payload: each argument, as a little-endian u32
+ *
+ * The console carries binary dumps, captures and profiles along with text,
+ * so a record needs the same framing as they do -- sync, length and CRC --
+ * for the host to pick it out reliably. log_decode.py finds the frames,
+ * reads the strings back out of the ELF and does the formatting on the host,
+ * passing the text between frames through. Since records wait for the main
+ * loop, text written to the console directly can overtake them.
+ *
+ * Format strings use a subset of printf: %x, %X, %u and %c, with an optional
+ * zero flag and width, and %%. Every argument is passed as a uint32_t.
+ *
+ * Building with EXTRACTOR_LOG_DEFERRED=0 formats on the device instead, for
+ * use with a plain serial terminal.
+ */
+
+#ifndef EXTRACTOR_LOG_DEFERRED
+#define EXTRACTOR_LOG_DEFERRED (1)
+#endif
+
+#define LOG_MAX_ARGS (8)
+
+#if EXTRACTOR_LOG_DEFERRED
+
+#define LOG(fmt, ...) \
+    do { \
+        static const char log_format[] __attribute__((section(".log_strings"), used)) = fmt; \
+        const uint32_t log_args[] = { 0, ##__VA_ARGS__ }; \
+        log_record((uint16_t)(uintptr_t)log_format, &log_args[1], \
+                sizeof(log_args) / sizeof(log_args[0]) - 1); \
+    } while(0)
+
+/**
+ * What recording has cost, as measured with the cycle counter.
+ */
+struct log_stats {
+    uint32_t records;
+    uint32_t dropped;
+    uint32_t max_cycles;
+    uint32_t total_cycles;
+};
+
+/**
+ * Sets up the queue records wait in; call this before the first LOG().
+ */
+void log_init(void);
+
+/**
+ * Queues a log record to be sent by log_flush. Use LOG() rather than calling
+ * this; and as the queue has a single producer, only from the main loop.
+ */
+void log_record(uint16_t id, const uint32_t *args, uint32_t count);
+
+/**
+ * Frames as many queued records onto the console as it has room for,
+ * without waiting for any more.
+ */
+void log_flush(void);
+
+/**
+ * @return True iff there are no records waiting to be sent.
+ */
+bool log_idle(void);
+
+const struct log_stats *log_get_stats(void);
+void log_reset_stats(void);
+
+#else
+
+#define LOG(fmt, ...) \
+    do { \
+        const uint32_t log_args[] = { 0, ##__VA_ARGS__ }; \
+        log_format(fmt, &log_args[1], sizeof(log_args) / sizeof(log_args[0]) - 1); \
+    } while(0)
+
+/**
+ * Formats a log message on the device and queues it on the console. Use
+ * LOG() rather than calling this.
+ */
+void log_format(const char *fmt, const uint32_t *args, uint32_t count);
+
+// Messages are sent as they're formatted, so there's never anything to flush.
+static inline void log_init(void) {}
+static inline void log_flush(void) {}
+static inline bool log_idle(void) { return true; }
+static inline void log_reset_stats(void) {}
+
+#endif
+
+#endif
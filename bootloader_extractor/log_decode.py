@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""
+Decodes the extractor's deferred log records back into text.
+
+The firmware sends only a string ID and raw arguments for each log message,
+framed just like a binary dump; the format strings themselves stay behind in
+the ELF's .log_strings section. This reads them from the ELF the running
+firmware was built from, and formats each record as it arrives, passing
+ordinary console text through untouched and leaving out any other frames.
+See log.h in the firmware for the record format.
+"""
+
+import struct
+import sys
+import time
+import zlib
+
+from serial import Serial
+
+from rx_bootloader import FRAME_SYNC, FRAME_HEADER, FRAME_TRAILER, MAX_PAYLOAD
+
+FRAME_LOG         = 0x0C
+
+# How long the device has to go quiet before we decide a command is done.
+IDLE_SECONDS      = 0.5
+
+
+def read_elf_sections(elf_filename):
+    """
+    Reads the sections out of an ELF, by name; shared with profile.py.
+
+    return: A (is_elf64, {section name: contents}) tuple.
+    """
+
+    with open(elf_filename, 'rb') as f:
+        elf = f.read()
+
+    if elf[:4] != b'\x7fELF' or elf[5] != 1:
+        raise ValueError("{} isn't a little-endian ELF".format(elf_filename))
+
+    # Find the section headers, which differ only in width between ELF32 and ELF64.
+    is_elf64 = elf[4] == 2
+    if not is_elf64:
+        shoff, = struct.unpack_from('<I', elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+        section = struct.Struct('<IIIIII')
+    else:
+        shoff, = struct.unpack_from('<Q', elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x3A)
+        section = struct.Struct('<IIQQQQ')
+
+    headers = [section.unpack_from(elf, shoff + i * shentsize) for i in range(shnum)]
+    names_offset = headers[shstrndx][4]
+    sections = {}
+
+    for name, _, _, _, offset, size in headers:
+        end = elf.index(b'\0', names_offset + name)
+        sections[elf[names_offset + name:end].decode(errors='replace')] = elf[offset:offset + size]
+
+    return is_elf64, sections
+
+
+def read_log_strings(elf_filename):
+    """
+    Reads the deferred log format strings out of an ELF.
+
+    return: The raw contents of the .log_strings section.
+    """
+
+    _, sections = read_elf_sections(elf_filename)
+
+    if '.log_strings' not in sections:
+        raise ValueError("{} has no .log_strings section; was it built with LOG_DEFERRED=0?".format(elf_filename))
+
+    return sections['.log_strings']
+
+
+class LogDecoder:
+    """
+    Turns a console byte stream containing log records back into text.
+    """
+
+    def __init__(self, elf_filename):
+        self.strings = read_log_strings(elf_filename)
+        self._pending = b''
+        self._next_sequence = None
+
+    def format(self, string_id, args):
+        """
+        Formats a single log record.
+        """
+
+        if string_id >= len(self.strings):
+            return "<unknown log string {:04X}: {}>\r\n".format(string_id, args)
+
+        end = self.strings.index(b'\0', string_id)
+        fmt = self.strings[string_id:end].decode(errors='replace')
+
+        try:
+            return fmt % tuple(args)
+        except (TypeError, ValueError):
+            return "<bad log record for {!r}: {}>\r\n".format(fmt, args)
+
+    def feed(self, data):
+        """
+        Decodes as much of the stream as we've received, holding on to any
+        incomplete frame until the rest of it arrives.
+
+        return: The decoded text.
+        """
+
+        data = self._pending + data
+        text = []
+        pos = 0
+
+        while pos < len(data):
+
+            # Pass through everything up to the next frame; keep back a lone
+            # first sync byte at the end, in case the second is on its way...
+            sync = data.find(FRAME_SYNC, pos)
+            if sync < 0:
+                sync = len(data) - 1 if data.endswith(FRAME_SYNC[:1]) else len(data)
+            text.append(data[pos:sync].decode(errors='replace'))
+            pos = sync
+
+            # ... and handle the frame itself, once it's all here.
+            header = pos + len(FRAME_SYNC)
+            if header + FRAME_HEADER.size > len(data):
+                break
+
+            frame_type, _, sequence, length, address = FRAME_HEADER.unpack_from(data, header)
+
+            # A length no frame can have means these weren't sync bytes after all.
+            if length > MAX_PAYLOAD:
+                text.append(data[pos:header].decode(errors='replace'))
+                pos = header
+                continue
+
+            payload = header + FRAME_HEADER.size
+            end = payload + length + FRAME_TRAILER.size
+            if end > len(data):
+                break
+
+            crc, = FRAME_TRAILER.unpack_from(data, end - FRAME_TRAILER.size)
+            if zlib.crc32(data[header:end - FRAME_TRAILER.size]) != crc:
+                text.append("<damaged frame>\r\n")
+            elif frame_type == FRAME_LOG:
+
+                # Records the device had no room for still used up a number;
+                # starting again from zero just means it was reset.
+                if self._next_sequence is not None and sequence not in (0, self._next_sequence):
+                    text.append("<{} log records dropped>\r\n".format((sequence - self._next_sequence) & 0xFFFF))
+                self._next_sequence = (sequence + 1) & 0xFFFF
+
+                args = struct.unpack_from('<{}I'.format(length // 4), data, payload)
+                text.append(self.format(address, args))
+
+            pos = end
+
+        self._pending = data[pos:]
+        return ''.join(text)
+
+
+def run_command(sp, decoder, command):
+    """
+    Sends a command, and prints its decoded output until the device goes quiet.
+    """
+
+    sp.write(command.encode() + b'\r')
+
+    last_data = time.time()
+    while time.time() - last_data < IDLE_SECONDS:
+        data = sp.read(sp.in_waiting or 1)
+        if data:
+            sys.stdout.write(decoder.feed(data))
+            sys.stdout.flush()
+            last_data = time.time()
+
+
+def usage():
+    print("usage: {} <extractor_elf> <serial_port> [command...]".format(sys.argv[0]))
+    print("       with no commands, prints decoded console output until interrupted")
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        usage()
+        sys.exit(0)
+
+    decoder = LogDecoder(sys.argv[1])
+    sp = Serial(sys.argv[2], timeout=0.1)
+
+    if len(sys.argv) > 3:
+        for command in sys.argv[3:]:
+            run_command(sp, decoder, command)
+        sys.exit(0)
+
+    try:
+        while True:
+            data = sp.read(sp.in_waiting or 1)
+            if data:
+                sys.stdout.write(decoder.feed(data))
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,117 @@
+/*
+ * Block compression for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+/**
+ * The most recent position (plus one, so zero can mean none) at which each
+ * hash of three bytes was seen. Kept small: flash images have few distinct
+ * patterns worth finding within a block, and a miss only costs us a literal.
+ */
+#define HASH_BITS (8)
+static uint16_t recent_positions[1 << HASH_BITS];
+
+static uint32_t hash(const uint8_t *pos)
+{
+    uint32_t key = pos[0] | (pos[1] << 8) | ((uint32_t)pos[2] << 16);
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * Appends a series of literals, in as many runs as it takes.
+ *
+ * @return The new output length, or zero if there wasn't room.
+ */
+static size_t emit_literals(const uint8_t *src, size_t len, uint8_t *dst, size_t out, size_t capacity)
+{
+    while(len) {
+        size_t run = (len > LZ_MAX_LITERALS) ? LZ_MAX_LITERALS : len;
+
+        if(capacity - out < run + 1)
+            return 0;
+
+        dst[out++] = run - 1;
+        memcpy(dst + out, src, run);
+
+        out += run;
+        src += run;
+        len -= run;
+    }
+
+    return out;
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity)
+{
+    size_t in = 0, out = 0, literal_start = 0;
+
+    if(len > LZ_MAX_BLOCK)
+        return 0;
+
+    memset(recent_positions, 0, sizeof(recent_positions));
+
+    while(in + LZ_MIN_MATCH <= len) {
+        uint32_t key = hash(src + in);
+        size_t candidate = recent_positions[key];
+        size_t match_len = 0;
+
+        recent_positions[key] = in + 1;
+
+        // See how far the last occurrence of this hash matches...
+        if(candidate) {
+            const uint8_t *earlier = src + candidate - 1;
+            size_t longest = len - in;
+
+            if(longest > LZ_MAX_MATCH)
+                longest = LZ_MAX_MATCH;
+
+            while(match_len < longest && earlier[match_len] == src[in + match_len])
+                ++match_len;
+        }
+
+        // ... and if it's not far enough to be worth a match, move on.
+        if(match_len < LZ_MIN_MATCH) {
+            ++in;
+            continue;
+        }
+
+        // Flush out anything we skipped over, then emit the match.
+        if(in > literal_start) {
+            out = emit_literals(src + literal_start, in - literal_start, dst, out, capacity);
+            if(!out)
+                return 0;
+        }
+
+        if(capacity - out < 3)
+            return 0;
+
+        dst[out++] = 0x80 | (match_len - LZ_MIN_MATCH);
+        dst[out++] = (in - (candidate - 1)) & 0xFF;
+        dst[out++] = (in - (candidate - 1)) >> 8;
+
+        in += match_len;
+        literal_start = in;
+    }
+
+    if(len > literal_start)
+        out = emit_literals(src + literal_start, len - literal_start, dst, out, capacity);
+
+    return out;
+}
@@ -0,0 +1,56 @@
+/*
+ * Block compression for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A small LZ77 codec for memory dumps, which are mostly runs of 0xFF or
+ * zero padding and repeated literal pools. Each block is compressed on its
+ * own, so any block can be decompressed (or re-requested) without the rest.
+ *
+ * A compressed block is a series of tokens:
+ *
+ *   0x00-0x7F  literals: the next (token + 1) bytes are copied as-is
+ *   0x80-0xFF  match: (token - 0x80 + LZ_MIN_MATCH) bytes are copied from
+ *              'distance' bytes back in the output, where distance is the
+ *              little-endian 16-bit value that follows the token
+ *
+ * A match may overlap the bytes it produces, so a distance of one repeats
+ * a single byte; that's how runs are encoded.
+ */
+#define LZ_MIN_MATCH (3)
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS (0x80)
+
+// The longest block lz_compress accepts; distances must fit the table.
+#define LZ_MAX_BLOCK (0xFFFF)
+
+/**
+ * Compresses a block of up to LZ_MAX_BLOCK bytes. The compressor keeps no
+ * window of its own; matches are found by looking back into the source.
+ *
+ * @return The compressed length, or zero if the block wouldn't compress to
+ *      capacity bytes or fewer.
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Statistical profiler for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "bindump.h"
+#include "console.h"
+#include "profile.h"
+#include "ringbuf_spsc.h"
+#include "timebase.h"
+
+/**
+ * Each sample is the stacked PC and LR. The ring holds a couple of frames'
+ * worth, so sampling can carry on while one is being sent.
+ */
+#define PROFILE_SAMPLE_SIZE (8)
+#define PROFILE_FRAME_SAMPLES (BINDUMP_MAX_PAYLOAD / PROFILE_SAMPLE_SIZE)
+#define PROFILE_RING_SAMPLES (PROFILE_FRAME_SAMPLES * 2)
+
+// How long samples can wait for a full frame before they're sent anyway,
+// in milliseconds; keeps slow profiles flowing.
+#define PROFILE_FLUSH_MS (100)
+
+// The positions of the PC and LR in the exception frame the hardware stacks.
+#define EXCEPTION_FRAME_LR (5)
+#define EXCEPTION_FRAME_PC (6)
+
+static uint8_t raw_samples[PROFILE_RING_SAMPLES * PROFILE_SAMPLE_SIZE];
+static struct ringbuf_spsc_t samples;
+
+static uint16_t sequence;
+static uint32_t last_frame_ms;
+
+static struct profile_stats stats;
+static volatile uint32_t samples_dropped;
+
+static uint8_t frame[PROFILE_FRAME_SAMPLES * PROFILE_SAMPLE_SIZE];
+
+
+/**
+ * Records one sample; called from tim3_isr with the exception frame it
+ * interrupted.
+ */
+static void __attribute__((used)) profile_sample(const uint32_t *exception_frame)
+{
+    uint32_t sample[2] = {
+        exception_frame[EXCEPTION_FRAME_PC],
+        exception_frame[EXCEPTION_FRAME_LR]
+    };
+
+    timer_clear_flag(TIM3, TIM_SR_UIF);
+
+    if(ringbuf_spsc_bytes_free(&samples) < sizeof(sample)) {
+        ++samples_dropped;
+        return;
+    }
+
+    ringbuf_spsc_memcpy_into(&samples, sample, sizeof(sample));
+}
+
+/**
+ * The sampling interrupt. C can't see the stacked registers, so this finds
+ * the exception frame -- on whichever stack was in use, per EXC_RETURN --
+ * and hands it to profile_sample, which returns from the exception for us.
+ */
+void __attribute__((naked)) tim3_isr(void)
+{
+    __asm__ volatile(
+        "tst lr, #4\n"
+        "ite eq\n"
+        "mrseq r0, msp\n"
+        "mrsne r0, psp\n"
+        "b profile_sample\n");
+}
+
+/**
+ * Sets up TIM3 to interrupt as close to the given rate as it can.
+ *
+ * @return The rate it'll actually run at.
+ */
+static uint32_t setup_timer(uint32_t rate)
+{
+    // TIM3's clock is twice APB1's whenever APB1 is divided down, as it is at 72MHz.
+    uint32_t clock = rcc_apb1_frequency * 2;
+    uint32_t ticks = (clock + rate / 2) / rate;
+    uint32_t prescaler = (ticks - 1) / 0x10000;
+    uint32_t period = ticks / (prescaler + 1);
+
+    rcc_periph_clock_enable(RCC_TIM3);
+    rcc_periph_reset_pulse(RST_TIM3);
+
+    timer_set_prescaler(TIM3, prescaler);
+    timer_set_period(TIM3, period - 1);
+    timer_enable_irq(TIM3, TIM_DIER_UIE);
+
+    // Pre-empt everything else, so we can see inside other interrupts.
+    nvic_set_priority(NVIC_TIM3_IRQ, 0);
+    nvic_enable_irq(NVIC_TIM3_IRQ);
+
+    return clock / ((prescaler + 1) * period);
+}
+
+void profile_start(uint32_t rate)
+{
+    if(rate > PROFILE_MAX_RATE)
+        rate = PROFILE_MAX_RATE;
+    if(rate == 0)
+        rate = 1;
+
+    ringbuf_spsc_init(&samples, raw_samples, sizeof(raw_samples));
+    memset(&stats, 0, sizeof(stats));
+    samples_dropped = 0;
+    sequence = 0;
+    last_frame_ms = timebase_now_ms();
+
+    stats.rate = setup_timer(rate);
+    bindump_send_frame(BINDUMP_FRAME_PROFILE_START, sequence++, 0, &stats.rate, sizeof(stats.rate));
+
+    timer_enable_counter(TIM3);
+}
+
+void profile_stop(void)
+{
+    timer_disable_counter(TIM3);
+    nvic_disable_irq(NVIC_TIM3_IRQ);
+}
+
+void profile_step(void)
+{
+    uint32_t now = timebase_now_ms();
+    size_t ready = ringbuf_spsc_bytes_used(&samples);
+
+    // Wait for a full frame, unless what we have has waited long enough.
+    if(ready < sizeof(frame) && !(ready && timebase_reached(now, last_frame_ms + PROFILE_FLUSH_MS)))
+        return;
+
+    // Only take what we're sure we can send.
+    if(console_bytes_free() < BINDUMP_MAX_FRAME_SIZE)
+        return;
+
+    ready = ringbuf_spsc_memcpy_from(frame, &samples, sizeof(frame));
+    bindump_send_frame(BINDUMP_FRAME_PC_SAMPLES, sequence++, stats.samples_sent, frame, ready);
+
+    stats.samples_sent += ready / PROFILE_SAMPLE_SIZE;
+    last_frame_ms = now;
+}
+
+const struct profile_stats *profile_get_stats(void)
+{
+    stats.samples_dropped = samples_dropped;
+    return &stats;
+}
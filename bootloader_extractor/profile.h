@@ -0,0 +1,81 @@
+/*
+ * Statistical profiler for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+/*
+ * Samples where the CPU is, for finding out where our time goes. A timer
+ * interrupt, at a higher priority than anything else, records the PC and LR
+ * that were stacked when it was taken; the samples are queued in a ring of
+ * their own, and streamed to the host in binary dump frames (see bindump.h):
+ *
+ *   PROFILE_START: sent once; address zero, and a payload of
+ *       u32 sample rate in Hz
+ *
+ *   PC_SAMPLES: address is the index of the frame's first sample among
+ *       those sent, counting from zero at the start of the profile; the
+ *       payload is a series of samples, each a u32 PC and a u32 LR
+ *
+ * Multi-byte fields are little-endian. The LR is only a hint at the caller:
+ * it's stale whenever the interrupted function has called something else
+ * since it was entered, and is an EXC_RETURN value (0xFFFFFFxx) if we
+ * interrupted the start of another interrupt handler. Samples taken while
+ * the ring is full are dropped, and only counted; see profile_get_stats.
+ *
+ * profile.py symbolizes the samples against the ELF the firmware was built
+ * from.
+ */
+
+// The fastest we'll sample; each sample is eight bytes on the wire.
+#define PROFILE_MAX_RATE (20000)
+
+/**
+ * Running statistics for the current (or last) profile.
+ */
+struct profile_stats {
+    uint32_t rate;
+    uint32_t samples_sent;
+
+    // Samples lost because the ring was full.
+    uint32_t samples_dropped;
+};
+
+/**
+ * Starts sampling at the closest rate to the one asked for that the timer
+ * can manage, and announces the profile to the host.
+ */
+void profile_start(uint32_t rate);
+
+/**
+ * Sends the next frame of samples, once there's a full frame's worth (or
+ * the samples have been waiting a while) and the console has room for it.
+ * Never finishes on its own; the profile runs until profile_stop.
+ */
+void profile_step(void);
+
+/**
+ * Stops sampling, ending the profile.
+ */
+void profile_stop(void);
+
+const struct profile_stats *profile_get_stats(void);
+
+#endif
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""
+Profiles the running firmware with the extractor's PC sampler ('p').
+
+Samples the PC (and LR) for a while, symbolizes the samples against the ELF
+the firmware was built from, and prints a flat profile: how many samples
+landed in each function. Optionally also writes the samples as collapsed
+stacks -- caller;function count -- for flamegraph.pl and friends. The caller
+comes from the sampled LR, so it's a hint rather than a backtrace; see
+profile.h in the firmware for the stream format and its caveats.
+"""
+
+import bisect
+import struct
+import sys
+import time
+
+from serial import Serial
+
+from log_decode import read_elf_sections
+from rx_bootloader import read_frame
+
+FRAME_PROFILE_START = 0x07
+FRAME_PC_SAMPLES    = 0x08
+
+SAMPLE              = struct.Struct('<II')
+
+CANCEL              = b'\x03'
+
+DEFAULT_RATE        = 1000
+
+# Symbol table entries, and the type of those that are functions.
+ELF32_SYMBOL        = struct.Struct('<IIIBBH')
+ELF64_SYMBOL        = struct.Struct('<IBBHQQ')
+STT_FUNC            = 2
+
+# LR values at or above this are EXC_RETURN codes, not addresses.
+EXC_RETURN_BASE     = 0xFFFFFFE0
+
+
+class Symbols:
+    """
+    Maps addresses to the functions that contain them.
+    """
+
+    def __init__(self, elf_filename):
+        is_elf64, sections = read_elf_sections(elf_filename)
+
+        if '.symtab' not in sections:
+            raise ValueError("{} has no symbol table; was it stripped?".format(elf_filename))
+
+        symtab = sections['.symtab']
+        strtab = sections['.strtab']
+        entry = ELF64_SYMBOL if is_elf64 else ELF32_SYMBOL
+        functions = []
+
+        for pos in range(0, len(symtab) - entry.size + 1, entry.size):
+            if is_elf64:
+                name, info, _, _, value, size = entry.unpack_from(symtab, pos)
+            else:
+                name, value, size, info, _, _ = entry.unpack_from(symtab, pos)
+
+            if info & 0xF != STT_FUNC or not size:
+                continue
+
+            end = strtab.index(b'\0', name)
+
+            # Thumb function symbols have their low bit set.
+            functions.append((value & ~1, size, strtab[name:end].decode(errors='replace')))
+
+        functions.sort()
+        self._starts = [start for start, _, _ in functions]
+        self._functions = functions
+
+    def lookup(self, address):
+        """
+        return: The name of the function containing the address, or the
+            address itself if there isn't one.
+        """
+
+        i = bisect.bisect_right(self._starts, address) - 1
+        if i >= 0:
+            start, size, name = self._functions[i]
+            if address < start + size:
+                return name
+
+        return "0x{:08X}".format(address)
+
+    def caller(self, lr):
+        """
+        return: The name of the function a sampled LR returns into.
+        """
+
+        if lr >= EXC_RETURN_BASE:
+            return "[exception]"
+
+        # The LR points just past the call; look up the call itself, in case
+        # it was the last thing in its function.
+        return self.lookup((lr & ~1) - 1)
+
+
+class Profile:
+    """
+    The samples from a profiling run, as they arrive from the device.
+    """
+
+    def __init__(self):
+        self.rate = None
+        self.samples = []
+        self.gaps = 0
+        self._next_index = 0
+
+    def add_frame(self, frame_type, address, payload):
+        if frame_type == FRAME_PROFILE_START:
+            self.rate, = struct.unpack_from('<I', payload)
+            return
+
+        if frame_type != FRAME_PC_SAMPLES:
+            return
+
+        # Frames that were damaged in transit show up as gaps.
+        if address != self._next_index:
+            self.gaps += 1
+
+        self.samples.extend(SAMPLE.iter_unpack(payload))
+        self._next_index = address + len(payload) // SAMPLE.size
+
+    def flat(self, symbols):
+        """
+        return: A list of (sample count, function) pairs, busiest first.
+        """
+
+        counts = {}
+        for pc, _ in self.samples:
+            name = symbols.lookup(pc)
+            counts[name] = counts.get(name, 0) + 1
+
+        return sorted(((count, name) for name, count in counts.items()), reverse=True)
+
+    def collapsed(self, symbols):
+        """
+        return: A dictionary of collapsed stacks to their sample counts.
+        """
+
+        stacks = {}
+        for pc, lr in self.samples:
+            function = symbols.lookup(pc)
+            caller = symbols.caller(lr)
+
+            # A function whose LR points back into itself has called something
+            # since it was entered; its real caller is lost.
+            stack = function if caller == function else '{};{}'.format(caller, function)
+            stacks[stack] = stacks.get(stack, 0) + 1
+
+        return stacks
+
+    def write_collapsed(self, symbols, filename):
+        with open(filename, 'w') as f:
+            for stack, count in sorted(self.collapsed(symbols).items()):
+                f.write('{} {}\n'.format(stack, count))
+
+
+def device_stats(sp):
+    """
+    Asks the device for its statistics on the last profile.
+
+    return: A dictionary of the values it reported.
+    """
+
+    sp.reset_input_buffer()
+    sp.write(b'p\r')
+
+    words = sp.readline().decode(errors='replace').split()
+    if not words or words[0] != 'profile:':
+        raise IOError("unexpected reply from device: {!r}".format(' '.join(words)))
+
+    words = words[1:]
+    return {name: int(value, 16) for name, value in zip(words[0::2], words[1::2])}
+
+
+def profile(sp, rate, seconds):
+    """
+    Samples the PC for the given time.
+
+    return: A (Profile, device statistics) tuple.
+    """
+
+    result = Profile()
+
+    sp.write(CANCEL + b'\r')
+    time.sleep(0.1)
+    sp.reset_input_buffer()
+
+    sp.write('p {}\r'.format(rate).encode())
+
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        if payload is not None:
+            result.add_frame(frame_type, address, payload)
+
+    # Stop sampling, and take whatever's still on its way.
+    sp.write(CANCEL)
+    while True:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        if payload is not None:
+            result.add_frame(frame_type, address, payload)
+
+    return (result, device_stats(sp))
+
+
+def usage():
+    print("usage: {} <extractor_elf> <serial_port> <seconds> [rate [collapsed_filename]]".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) not in (4, 5, 6):
+        usage()
+        sys.exit(0)
+
+    symbols = Symbols(sys.argv[1])
+    sp = Serial(sys.argv[2], timeout=1)
+    rate = int(sys.argv[4], 0) if len(sys.argv) >= 5 else DEFAULT_RATE
+
+    result, stats = profile(sp, rate, float(sys.argv[3]))
+    total = len(result.samples)
+
+    print("{:>8}  {:>6}  function".format("samples", "%"))
+    for count, name in result.flat(symbols):
+        print("{:>8}  {:>6.2f}  {}".format(count, 100.0 * count / total, name))
+
+    if len(sys.argv) == 6:
+        result.write_collapsed(symbols, sys.argv[5])
+
+    print("bench=profile rate={} samples={} dropped={} gaps={}".format(
+        result.rate, total, stats['dropped'], result.gaps))
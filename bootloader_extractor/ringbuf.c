@@ -22,6 +22,11 @@
 #include <unistd.h>
 #include <sys/param.h>
 #include <assert.h>
+#include <errno.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#endif
 
 /*
  * The code is written for clarity, not cleverness or performance, and
@@ -125,23 +130,213 @@ ringbuf_nextp(ringbuf_t rb, const uint8_t *p)
     return rb->buf + ((++p - rb->buf) % ringbuf_buffer_size(rb));
 }
 
+/*
+ * Byte-set scanning, shared by ringbuf_findchr, ringbuf_findany and
+ * ringbuf_memmem.
+ *
+ * Small sets are matched by comparing against each member in turn:
+ * 16 bytes at a time with SSE2 on hosts that have it, or a machine
+ * word at a time elsewhere (including the Cortex-M3, whose size-
+ * optimized newlib memchr works a byte at a time). Larger sets fall
+ * back to a bitmap lookup per byte.
+ */
+#if defined(__SSE2__) && !defined(RINGBUF_NO_SIMD)
+#include <emmintrin.h>
+#define RINGBUF_SCAN_SSE2
+#endif
+
+#define SCAN_MAX_COMPARE_SET    4
+
+typedef unsigned long __attribute__((may_alias)) scan_word_t;
+
+#define SCAN_ONES               ((scan_word_t)-1 / 0xFF)
+#define SCAN_HIGHS              (SCAN_ONES * 0x80)
+
+/*
+ * Nonzero iff some byte of v is zero. May also flag bytes above a
+ * zero byte, so a hit only tells us which word to look at closely.
+ */
+#define SCAN_HAS_ZERO_BYTE(v)   (((v) - SCAN_ONES) & ~(v) & SCAN_HIGHS)
+
+static int
+scan_in_set(uint8_t c, const uint8_t *set, size_t nset)
+{
+    for (size_t i = 0; i < nset; ++i)
+        if (c == set[i])
+            return 1;
+    return 0;
+}
+
+static const uint8_t *
+scan_bitmap(const uint8_t *p, size_t n, const uint8_t *set, size_t nset)
+{
+    uint32_t map[256 / 32] = { 0 };
+
+    for (size_t i = 0; i < nset; ++i)
+        map[set[i] / 32] |= 1UL << (set[i] % 32);
+
+    for (const uint8_t *end = p + n; p < end; ++p)
+        if (map[*p / 32] & (1UL << (*p % 32)))
+            return p;
+
+    return NULL;
+}
+
+/*
+ * Return a pointer to the first byte in [p, p + n) that's a member of
+ * the nset-byte set, or NULL if there isn't one.
+ */
+static const uint8_t *
+scan_any(const uint8_t *p, size_t n, const uint8_t *set, size_t nset)
+{
+    const uint8_t *end = p + n;
+
+    if (nset > SCAN_MAX_COMPARE_SET)
+        return scan_bitmap(p, n, set, nset);
+
+#ifdef RINGBUF_SCAN_SSE2
+    /* The host's memchr is already vectorized. */
+    if (nset == 1)
+        return memchr(p, set[0], n);
+
+    __m128i members[SCAN_MAX_COMPARE_SET];
+    for (size_t i = 0; i < nset; ++i)
+        members[i] = _mm_set1_epi8((char)set[i]);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_cmpeq_epi8(v, members[0]);
+        for (size_t i = 1; i < nset; ++i)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, members[i]));
+
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    scan_word_t members[SCAN_MAX_COMPARE_SET];
+    for (size_t i = 0; i < nset; ++i)
+        members[i] = SCAN_ONES * set[i];
+
+    /* Get to a word boundary... */
+    for (; p < end && ((uintptr_t)p % sizeof(scan_word_t)); ++p)
+        if (scan_in_set(*p, set, nset))
+            return p;
+
+    /* ... and skip whole words that can't contain a match. */
+    while ((size_t)(end - p) >= sizeof(scan_word_t)) {
+        scan_word_t w = *(const scan_word_t *)p;
+        scan_word_t hits = 0;
+        for (size_t i = 0; i < nset; ++i)
+            hits |= SCAN_HAS_ZERO_BYTE(w ^ members[i]);
+
+        if (hits)
+            break;
+        p += sizeof(scan_word_t);
+    }
+#endif
+
+    for (; p < end; ++p)
+        if (scan_in_set(*p, set, nset))
+            return p;
+
+    return NULL;
+}
+
+/*
+ * Return a pointer to the byte 'offset' bytes past the ring buffer's
+ * tail pointer, which must be less than the buffer size.
+ */
+static const uint8_t *
+ringbuf_logical(const struct ringbuf_t *rb, size_t offset)
+{
+    size_t linear = (rb->tail - rb->buf) + offset;
+
+    assert(offset < ringbuf_buffer_size(rb));
+    if (linear >= ringbuf_buffer_size(rb))
+        linear -= ringbuf_buffer_size(rb);
+
+    return rb->buf + linear;
+}
+
+/*
+ * Find the first byte from the given set at or after logical offset
+ * 'offset', scanning the (at most two) contiguous segments in turn.
+ */
+static size_t
+ringbuf_scan(const struct ringbuf_t *rb, const uint8_t *set, size_t nset, size_t offset)
+{
+    const uint8_t *bufend = ringbuf_end(rb);
+    size_t bytes_used = ringbuf_bytes_used(rb);
+
+    while (offset < bytes_used) {
+        const uint8_t *start = ringbuf_logical(rb, offset);
+        assert(bufend > start);
+        size_t n = MIN((size_t)(bufend - start), bytes_used - offset);
+        const uint8_t *found = scan_any(start, n, set, nset);
+        if (found)
+            return offset + (found - start);
+        offset += n;
+    }
+
+    return bytes_used;
+}
+
+/*
+ * Return nonzero iff the len bytes at logical offset 'offset' match
+ * those at 'data', comparing across the wrap point if needed.
+ */
+static int
+ringbuf_matches(const struct ringbuf_t *rb, size_t offset, const uint8_t *data, size_t len)
+{
+    if (len == 0)
+        return 1;
+
+    const uint8_t *start = ringbuf_logical(rb, offset);
+    size_t n = MIN((size_t)(ringbuf_end(rb) - start), len);
+
+    return memcmp(start, data, n) == 0 &&
+        memcmp(rb->buf, data + n, len - n) == 0;
+}
+
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
+    uint8_t ch = (uint8_t)c;
+    return ringbuf_scan(rb, &ch, 1, offset);
+}
+
+size_t
+ringbuf_findany(const struct ringbuf_t *rb, const void *set, size_t nset, size_t offset)
+{
+    if (nset == 0)
+        return ringbuf_bytes_used(rb);
+
+    return ringbuf_scan(rb, set, nset, offset);
+}
+
+size_t
+ringbuf_memmem(const struct ringbuf_t *rb, const void *needle, size_t len, size_t offset)
+{
+    const uint8_t *u8needle = needle;
     size_t bytes_used = ringbuf_bytes_used(rb);
-    if (offset >= bytes_used)
-        return bytes_used;
-
-    const uint8_t *start = rb->buf +
-        (((rb->tail - rb->buf) + offset) % ringbuf_buffer_size(rb));
-    assert(bufend > start);
-    size_t n = MIN(bufend - start, bytes_used - offset);
-    const uint8_t *found = memchr(start, c, n);
-    if (found)
-        return offset + (found - start);
-    else
-        return ringbuf_findchr(rb, c, offset + n);
+
+    if (len == 0)
+        return MIN(offset, bytes_used);
+
+    /* Find each candidate first byte quickly, then check the rest. */
+    while (offset < bytes_used && len <= bytes_used - offset) {
+        offset = ringbuf_scan(rb, u8needle, 1, offset);
+        if (offset >= bytes_used || len > bytes_used - offset)
+            break;
+
+        if (ringbuf_matches(rb, offset + 1, u8needle + 1, len - 1))
+            return offset;
+        ++offset;
+    }
+
+    return bytes_used;
 }
 
 size_t
@@ -282,6 +477,140 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count)
     return n;
 }
 
+#if defined(__unix__) || defined(__APPLE__)
+
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count)
+{
+    const uint8_t *bufend = ringbuf_end(rb);
+    size_t nfree = ringbuf_bytes_free(rb);
+    struct iovec iov[2];
+    int iovcnt;
+
+    count = MIN(count, nfree);
+    if (count == 0)
+        return 0;
+
+    /* The free space runs from the head up to the byte before the tail. */
+    assert(bufend > rb->head);
+    iov[0].iov_base = rb->head;
+    iov[0].iov_len = MIN((size_t)(bufend - rb->head), count);
+    iovcnt = 1;
+    if (iov[0].iov_len < count) {
+        iov[1].iov_base = rb->buf;
+        iov[1].iov_len = count - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    ssize_t n = readv(fd, iov, iovcnt);
+    if (n > 0) {
+        assert((size_t)n <= nfree);
+        rb->head = rb->buf + ((rb->head - rb->buf) + n) % ringbuf_buffer_size(rb);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (count > bytes_used || count == 0)
+        return 0;
+
+    const uint8_t *bufend = ringbuf_end(rb);
+    struct iovec iov[2];
+    int iovcnt;
+
+    assert(bufend > rb->tail);
+    iov[0].iov_base = rb->tail;
+    iov[0].iov_len = MIN((size_t)(bufend - rb->tail), count);
+    iovcnt = 1;
+    if (iov[0].iov_len < count) {
+        iov[1].iov_base = rb->buf;
+        iov[1].iov_len = count - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n > 0) {
+        rb->tail = rb->buf + ((rb->tail - rb->buf) + n) % ringbuf_buffer_size(rb);
+        assert(n + ringbuf_bytes_used(rb) == bytes_used);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_relay(int in_fd, int out_fd, ringbuf_t rb)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+
+    if (bytes_used && ringbuf_writev(out_fd, rb, bytes_used) < 0)
+        return -1;
+
+    if (ringbuf_is_full(rb)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return ringbuf_readv(in_fd, rb, ringbuf_bytes_free(rb));
+}
+
+#endif
+
+size_t
+ringbuf_peek_contiguous(const struct ringbuf_t *rb, const void **data)
+{
+    *data = rb->tail;
+
+    /* If the used region wraps, only the part up to the end is contiguous. */
+    if (rb->head >= rb->tail)
+        return rb->head - rb->tail;
+    else
+        return ringbuf_end(rb) - rb->tail;
+}
+
+void
+ringbuf_consume(ringbuf_t rb, size_t count)
+{
+    const uint8_t *bufend = ringbuf_end(rb);
+
+    assert(count <= ringbuf_bytes_used(rb));
+    assert(rb->tail + count <= bufend);
+    rb->tail += count;
+
+    /* wrap? */
+    if (rb->tail == bufend)
+        rb->tail = rb->buf;
+}
+
+size_t
+ringbuf_reserve(ringbuf_t rb, void **data)
+{
+    const uint8_t *bufend = ringbuf_end(rb);
+    size_t n = ringbuf_bytes_free(rb);
+
+    *data = rb->head;
+
+    /* don't hand out space beyond the end of the buffer */
+    return MIN((size_t)(bufend - rb->head), n);
+}
+
+void
+ringbuf_commit(ringbuf_t rb, size_t count)
+{
+    const uint8_t *bufend = ringbuf_end(rb);
+
+    assert(count <= ringbuf_bytes_free(rb));
+    assert(rb->head + count <= bufend);
+    rb->head += count;
+
+    /* wrap? */
+    if (rb->head == bufend)
+        rb->head = rb->buf;
+}
+
 void *
 ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
 {
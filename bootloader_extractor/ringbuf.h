@@ -27,6 +27,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 
@@ -117,6 +118,26 @@ ringbuf_head(const struct ringbuf_t *rb);
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
 
+/*
+ * Like ringbuf_findchr, but locate the first byte that's any of the
+ * nset bytes at 'set' (e.g., any of ":\r\n"). Returns the logical
+ * offset of the byte from the tail pointer if found, or the number of
+ * bytes used in the ring buffer if not.
+ */
+size_t
+ringbuf_findany(const struct ringbuf_t *rb, const void *set, size_t nset, size_t offset);
+
+/*
+ * Locate the first occurrence of the len-byte sequence 'needle' in
+ * ring buffer rb, beginning the search at logical offset 'offset'
+ * from the tail pointer. Matches may straddle the end of the internal
+ * buffer; the contents are never linearized. Returns the logical
+ * offset of the start of the match if found, or the number of bytes
+ * used in the ring buffer if not.
+ */
+size_t
+ringbuf_memmem(const struct ringbuf_t *rb, const void *needle, size_t len, size_t offset);
+
 /*
  * Beginning at ring buffer dst's head pointer, fill the ring buffer
  * with a repeating sequence of len bytes, each of value c (converted
@@ -214,6 +235,76 @@ ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
 ssize_t
 ringbuf_write(int fd, ringbuf_t rb, size_t count);
 
+#if defined(__unix__) || defined(__APPLE__)
+
+/*
+ * Scatter/gather variants of ringbuf_read and ringbuf_write, for
+ * hosts that provide readv(2) and writev(2).
+ *
+ * ringbuf_read and ringbuf_write only transfer the contiguous part
+ * of the buffer up to its end, so moving data that wraps takes two
+ * calls (and two syscalls). These pass both segments to a single
+ * readv(2) or writev(2) call instead. Return values are as for
+ * ringbuf_read and ringbuf_write, with one difference: ringbuf_readv
+ * never overflows the ring buffer, and reads at most
+ * ringbuf_bytes_free(rb) bytes.
+ */
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count);
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * Move one batch of data from in_fd to out_fd through the ring
+ * buffer rb: first flush as much of rb's contents to out_fd as a
+ * single writev(2) will take, then refill rb from in_fd with a single
+ * readv(2). Call it in a loop to relay a stream, e.g., from a CDC
+ * tty to a log file.
+ *
+ * Returns the value returned by readv(2), so 0 indicates end-of-file
+ * on in_fd (any data still in rb can be flushed with
+ * ringbuf_writev). Returns -1 with errno set if the writev(2) fails,
+ * or with errno set to EAGAIN if out_fd accepted nothing and rb is
+ * still full, in which case no read is attempted.
+ */
+ssize_t
+ringbuf_relay(int in_fd, int out_fd, ringbuf_t rb);
+
+#endif
+
+/*
+ * Zero-copy access to the ring buffer's contents.
+ *
+ * ringbuf_peek_contiguous sets *data to the ring buffer's tail
+ * pointer, and returns the number of bytes that can be read from
+ * there without wrapping. Once the caller is done with (some of)
+ * those bytes, it calls ringbuf_consume to release them. If the used
+ * data wraps around the end of the internal buffer, a second peek
+ * after consuming the first span returns the remainder.
+ *
+ * ringbuf_reserve is the producer-side equivalent: it sets *data to
+ * the ring buffer's head pointer, and returns the number of bytes
+ * that can be written there without wrapping *or* overwriting unread
+ * data. The caller fills in (some of) those bytes, and then calls
+ * ringbuf_commit to make them part of the buffer's contents.
+ *
+ * Neither function copies anything, and neither span is valid after
+ * any other function modifies the ring buffer. count must not exceed
+ * the length of the most recently returned span.
+ */
+size_t
+ringbuf_peek_contiguous(const struct ringbuf_t *rb, const void **data);
+
+void
+ringbuf_consume(ringbuf_t rb, size_t count);
+
+size_t
+ringbuf_reserve(ringbuf_t rb, void **data);
+
+void
+ringbuf_commit(ringbuf_t rb, size_t count);
+
 /*
  * Copy count bytes from ring buffer src, starting from its tail
  * pointer, into ring buffer dst. Returns dst's new head pointer after
@@ -0,0 +1,182 @@
+/*
+ * ringbuf_spsc.c - lock-free single-producer/single-consumer ring buffer.
+ *
+ * Based on ringbuf.c, written in 2011 by Drew Hess <dhess-src@bothan.net>.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "ringbuf_spsc.h"
+
+#include <string.h>
+#include <sys/param.h>
+#include <assert.h>
+
+/*
+ * Each index has exactly one writer. A side may read its own index
+ * with a relaxed load, but must load the other side's index with
+ * acquire semantics (so we see the bytes it published), and must
+ * publish its own index with release semantics (so the other side
+ * sees our bytes before it sees the new index).
+ */
+#define load_own(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define load_other(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define publish(p, v)       __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+void
+ringbuf_spsc_init(ringbuf_spsc_t rb, uint8_t *raw_storage, size_t storage_size)
+{
+    assert(storage_size > 1 && (storage_size & (storage_size - 1)) == 0);
+    rb->buf = raw_storage;
+    rb->size = storage_size;
+    rb->mask = storage_size - 1;
+    ringbuf_spsc_reset(rb);
+}
+
+void
+ringbuf_spsc_reset(ringbuf_spsc_t rb)
+{
+    rb->head = rb->tail = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+size_t
+ringbuf_spsc_capacity(const struct ringbuf_spsc_t *rb)
+{
+    return rb->size;
+}
+
+size_t
+ringbuf_spsc_bytes_free(const struct ringbuf_spsc_t *rb)
+{
+    size_t tail = load_other(&rb->tail);
+    size_t head = load_own(&rb->head);
+    return rb->size - (head - tail);
+}
+
+size_t
+ringbuf_spsc_bytes_used(const struct ringbuf_spsc_t *rb)
+{
+    size_t head = load_other(&rb->head);
+    size_t tail = load_own(&rb->tail);
+    return head - tail;
+}
+
+int
+ringbuf_spsc_is_full(const struct ringbuf_spsc_t *rb)
+{
+    return ringbuf_spsc_bytes_free(rb) == 0;
+}
+
+int
+ringbuf_spsc_is_empty(const struct ringbuf_spsc_t *rb)
+{
+    return ringbuf_spsc_bytes_used(rb) == 0;
+}
+
+/*
+ * How many of count bytes, starting at the given counter, fit before
+ * the end of the storage.
+ */
+static size_t
+ringbuf_spsc_contiguous(const struct ringbuf_spsc_t *rb, size_t counter, size_t count)
+{
+    return MIN(count, rb->size - (counter & rb->mask));
+}
+
+size_t
+ringbuf_spsc_memcpy_into(ringbuf_spsc_t dst, const void *src, size_t count)
+{
+    const uint8_t *u8src = src;
+    size_t head = load_own(&dst->head);
+    size_t n;
+
+    count = MIN(count, ringbuf_spsc_bytes_free(dst));
+
+    /* At most two pieces: up to the end of the storage, then from its start. */
+    n = ringbuf_spsc_contiguous(dst, head, count);
+    memcpy(dst->buf + (head & dst->mask), u8src, n);
+    if (n != count)
+        memcpy(dst->buf, u8src + n, count - n);
+
+    publish(&dst->head, head + count);
+    return count;
+}
+
+size_t
+ringbuf_spsc_memcpy_from(void *dst, ringbuf_spsc_t src, size_t count)
+{
+    uint8_t *u8dst = dst;
+    size_t tail = load_own(&src->tail);
+    size_t n;
+
+    count = MIN(count, ringbuf_spsc_bytes_used(src));
+
+    /* At most two pieces: up to the end of the storage, then from its start. */
+    n = ringbuf_spsc_contiguous(src, tail, count);
+    memcpy(u8dst, src->buf + (tail & src->mask), n);
+    if (n != count)
+        memcpy(u8dst + n, src->buf, count - n);
+
+    publish(&src->tail, tail + count);
+    return count;
+}
+
+size_t
+ringbuf_spsc_peek_contiguous(const struct ringbuf_spsc_t *rb, const void **data)
+{
+    size_t tail = load_own(&rb->tail);
+
+    *data = rb->buf + (tail & rb->mask);
+
+    /* If the used region wraps, only the part up to the end is contiguous. */
+    return ringbuf_spsc_contiguous(rb, tail, ringbuf_spsc_bytes_used(rb));
+}
+
+void
+ringbuf_spsc_consume(ringbuf_spsc_t rb, size_t count)
+{
+    size_t tail = load_own(&rb->tail);
+
+    assert(count <= ringbuf_spsc_bytes_used(rb));
+    assert(count <= ringbuf_spsc_contiguous(rb, tail, count));
+    publish(&rb->tail, tail + count);
+}
+
+size_t
+ringbuf_spsc_reserve(ringbuf_spsc_t rb, void **data)
+{
+    size_t head = load_own(&rb->head);
+
+    *data = rb->buf + (head & rb->mask);
+
+    /* don't hand out space beyond the end of the buffer */
+    return ringbuf_spsc_contiguous(rb, head, ringbuf_spsc_bytes_free(rb));
+}
+
+void
+ringbuf_spsc_commit(ringbuf_spsc_t rb, size_t count)
+{
+    size_t head = load_own(&rb->head);
+
+    assert(count <= ringbuf_spsc_bytes_free(rb));
+    assert(count <= ringbuf_spsc_contiguous(rb, head, count));
+    publish(&rb->head, head + count);
+}
+
+size_t
+ringbuf_spsc_skip(ringbuf_spsc_t rb, size_t count)
+{
+    size_t tail = load_own(&rb->tail);
+
+    count = MIN(count, ringbuf_spsc_bytes_used(rb));
+    publish(&rb->tail, tail + count);
+    return count;
+}
@@ -0,0 +1,147 @@
+#ifndef INCLUDED_RINGBUF_SPSC_H
+#define INCLUDED_RINGBUF_SPSC_H
+
+/*
+ * ringbuf_spsc.h - lock-free single-producer/single-consumer ring buffer.
+ *
+ * A variant of the ringbuf_t FIFO that can be shared between exactly
+ * one producer and exactly one consumer running in different
+ * contexts (e.g., an interrupt handler and the main loop, or two
+ * threads) without any locking.
+ *
+ * Unlike ringbuf_t, which may move its tail pointer when a write
+ * overflows, every index here has exactly one writer: the head is
+ * only ever written by the producer, and the tail is only ever
+ * written by the consumer. Writes never overwrite unread data; they
+ * are simply truncated to the amount of free space.
+ *
+ * Each side publishes its index with release semantics only after
+ * it has finished touching the underlying bytes, and reads the other
+ * side's index with acquire semantics before touching them. On the
+ * Cortex-M3 this compiles to a plain load/store plus a DMB.
+ *
+ * The storage must be a power of two in size. The head and tail are
+ * free-running byte counters rather than offsets: the number of bytes
+ * used is simply head - tail (which wraps correctly in unsigned
+ * arithmetic), and a counter becomes an offset by masking it with
+ * size - 1. No division or wrap test is ever needed, and no byte of
+ * storage is wasted telling "full" from "empty".
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+struct ringbuf_spsc_t
+{
+    uint8_t *buf;
+    size_t size;
+
+    /* size - 1, for turning a counter into an offset. */
+    size_t mask;
+
+    /* Bytes ever written; written only by the producer. */
+    size_t head;
+
+    /* Bytes ever read; written only by the consumer. */
+    size_t tail;
+};
+typedef struct ringbuf_spsc_t *ringbuf_spsc_t;
+
+/*
+ * Initialize a ring buffer over storage_size bytes of raw_storage,
+ * which must be a power of two. All of it is usable.
+ */
+void
+ringbuf_spsc_init(ringbuf_spsc_t rb, uint8_t *raw_storage, size_t storage_size);
+
+/*
+ * Reset the ring buffer to its initial (empty) state. This touches
+ * both indices, and so must only be called while neither the
+ * producer nor the consumer can be running.
+ */
+void
+ringbuf_spsc_reset(ringbuf_spsc_t rb);
+
+/*
+ * The usable capacity of the ring buffer, in bytes.
+ */
+size_t
+ringbuf_spsc_capacity(const struct ringbuf_spsc_t *rb);
+
+/*
+ * The number of bytes the producer can currently write. From the
+ * producer's context this is a lower bound: the consumer may free
+ * more space at any time, but never less.
+ */
+size_t
+ringbuf_spsc_bytes_free(const struct ringbuf_spsc_t *rb);
+
+/*
+ * The number of bytes the consumer can currently read. From the
+ * consumer's context this is a lower bound: the producer may add
+ * more data at any time, but never less.
+ */
+size_t
+ringbuf_spsc_bytes_used(const struct ringbuf_spsc_t *rb);
+
+int
+ringbuf_spsc_is_full(const struct ringbuf_spsc_t *rb);
+
+int
+ringbuf_spsc_is_empty(const struct ringbuf_spsc_t *rb);
+
+/*
+ * Producer side: copy up to count bytes from src into the ring
+ * buffer. Never overwrites unread data; if there isn't room for all
+ * count bytes, only as many as fit are copied.
+ *
+ * Returns the number of bytes actually copied.
+ */
+size_t
+ringbuf_spsc_memcpy_into(ringbuf_spsc_t dst, const void *src, size_t count);
+
+/*
+ * Consumer side: copy up to count bytes out of the ring buffer into
+ * the contiguous memory area dst. Unlike ringbuf_memcpy_from, a
+ * request for more data than is available is not an error; as many
+ * bytes as are available are copied.
+ *
+ * Returns the number of bytes actually copied.
+ */
+size_t
+ringbuf_spsc_memcpy_from(void *dst, ringbuf_spsc_t src, size_t count);
+
+/*
+ * Zero-copy access, as with ringbuf_peek_contiguous, ringbuf_consume,
+ * ringbuf_reserve and ringbuf_commit. The peek/consume pair may only
+ * be used by the consumer, and the reserve/commit pair only by the
+ * producer. A span stays valid until it's consumed or committed, as
+ * the other side never touches it.
+ */
+size_t
+ringbuf_spsc_peek_contiguous(const struct ringbuf_spsc_t *rb, const void **data);
+
+void
+ringbuf_spsc_consume(ringbuf_spsc_t rb, size_t count);
+
+size_t
+ringbuf_spsc_reserve(ringbuf_spsc_t rb, void **data);
+
+void
+ringbuf_spsc_commit(ringbuf_spsc_t rb, size_t count);
+
+/*
+ * Consumer side: discard up to count bytes from the tail of the ring
+ * buffer without copying them anywhere, wrapping as needed. Returns
+ * the number of bytes actually discarded.
+ *
+ * A producer may use this to drop the oldest data to make room, but
+ * only while the consumer is guaranteed not to run (e.g., with its
+ * interrupt masked).
+ */
+size_t
+ringbuf_spsc_skip(ringbuf_spsc_t rb, size_t count);
+
+#endif /* INCLUDED_RINGBUF_SPSC_H */
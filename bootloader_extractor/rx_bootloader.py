@@ -1,11 +1,30 @@
 #!/usr/bin/env python3
 
 import sys
+import struct
+import zlib
 
 from intelhex import IntelHex
 from serial import Serial
 from io import StringIO
 
+# Binary dump framing; see bindump.h in the firmware for the layout.
+FRAME_SYNC     = b'\xA5\x5A'
+FRAME_HEADER   = struct.Struct('<BBHHI')
+FRAME_TRAILER  = struct.Struct('<I')
+FRAME_DATA     = 0x01
+FRAME_END      = 0x02
+FRAME_ERROR    = 0x03
+FRAME_LZ       = 0x04
+MAX_PAYLOAD    = 512
+
+# Compressed frame tokens; see lz.h in the firmware.
+LZ_MIN_MATCH   = 3
+
+# How many times we'll re-request frames that arrived damaged or not at all.
+MAX_RETRIES    = 8
+
+
 def read_bootloader_ihex(port_name):
     """
     Reads the bootloader .text from the extractor running on the device.
@@ -19,40 +38,201 @@ def read_bootloader_ihex(port_name):
     sp = Serial(port_name, timeout=1)
 
     # Ask the target device to dump...
-    sp.write(b'd')
+    sp.write(b'd\r')
 
     while True:
 
-        # Attempt to read one line of the provided intel hex file.
-        line = sp.read(45)
+        # Attempt to read one record of the provided intel hex file; these
+        # aren't all the same length, as extended address records are shorter.
+        line = sp.readline()
         lines.append(line)
 
         if line == b":00000001FF\r\n":
             break
-        if line == '':
+        if not line:
             break
 
     sublines = [line.decode() for line in lines]
     return ''.join(sublines)
 
 
+def read_frame(sp):
+    """
+    Reads the next frame from the device, skipping anything before its sync bytes.
+
+    return: A (type, sequence, address, payload) tuple; the payload is None if the frame
+            was damaged. Returns None if the device stops sending.
+    """
+
+    # Hunt for the sync bytes.
+    window = b''
+    while window != FRAME_SYNC:
+        byte = sp.read(1)
+        if not byte:
+            return None
+        window = (window + byte)[-2:]
+
+    header = sp.read(FRAME_HEADER.size)
+    if len(header) != FRAME_HEADER.size:
+        return None
+
+    frame_type, _, sequence, length, address = FRAME_HEADER.unpack(header)
+
+    # A corrupted length could have us wait on data that's never coming;
+    # treat it as a damaged frame and resynchronize on what follows.
+    if length > MAX_PAYLOAD:
+        return (frame_type, sequence, address, None)
+
+    payload = sp.read(length)
+    trailer = sp.read(FRAME_TRAILER.size)
+    if len(payload) != length or len(trailer) != FRAME_TRAILER.size:
+        return None
+
+    crc, = FRAME_TRAILER.unpack(trailer)
+    if zlib.crc32(header + payload) != crc:
+        return (frame_type, sequence, address, None)
+
+    return (frame_type, sequence, address, payload)
+
+
+def lz_decompress(data):
+    """
+    Expands the payload of a compressed frame.
+
+    return: The decompressed data, or None if the payload isn't valid.
+    """
+
+    out = bytearray()
+    pos = 0
+
+    while pos < len(data):
+        token = data[pos]
+        pos += 1
+
+        # Literals are copied as-is...
+        if token < 0x80:
+            count = token + 1
+            if pos + count > len(data):
+                return None
+
+            out += data[pos:pos + count]
+            pos += count
+
+        # ... and matches copied from earlier output, a byte at a time, as they
+        # can overlap the bytes they produce.
+        else:
+            if pos + 2 > len(data):
+                return None
+
+            count = token - 0x80 + LZ_MIN_MATCH
+            distance = data[pos] | (data[pos + 1] << 8)
+            pos += 2
+
+            if not 0 < distance <= len(out):
+                return None
+
+            for _ in range(count):
+                out.append(out[-distance])
+
+    return bytes(out)
+
+
+def request_range(sp, address, length, compress=False):
+    """
+    Requests a binary dump of the given range, and collects every intact data frame,
+    decompressing them as they arrive if compression was requested.
+
+    return: A dictionary mapping frame addresses to their payloads.
+    """
+
+    frames = {}
+
+    sp.write('b 0x{:x} 0x{:x}{}\r'.format(address, length, ' z' if compress else '').encode())
+
+    while True:
+        frame = read_frame(sp)
+
+        if frame is None:
+            break
+
+        frame_type, _, frame_address, payload = frame
+
+        if payload is None:
+            continue
+        if frame_type == FRAME_ERROR:
+            raise IOError("device can't read 0x{:08x}+0x{:x}".format(address, length))
+        if frame_type == FRAME_END:
+            break
+        if frame_type == FRAME_DATA:
+            frames[frame_address] = payload
+        if frame_type == FRAME_LZ:
+            payload = lz_decompress(payload)
+            expected = min(MAX_PAYLOAD, address + length - frame_address)
+
+            # A frame that doesn't expand to exactly its range is as good as missing.
+            if payload is not None and len(payload) == expected:
+                frames[frame_address] = payload
+
+    return frames
+
+
+def read_memory_binary(port_name, address, length, compress=False):
+    """
+    Reads an arbitrary range of the device's memory using the binary dump protocol,
+    re-requesting any frames that went missing or arrived damaged.
+
+    return: The contents of the requested range, as bytes.
+    """
+
+    sp = Serial(port_name, timeout=1)
+
+    # Start by requesting the whole range...
+    frames = request_range(sp, address, length, compress)
+
+    # ... and then only the frames we don't have yet.
+    for attempt in range(MAX_RETRIES + 1):
+        missing = [frame_address for frame_address in range(address, address + length, MAX_PAYLOAD)
+                   if frame_address not in frames]
+
+        if not missing:
+            break
+        if attempt == MAX_RETRIES:
+            raise IOError("gave up after {} retries".format(MAX_RETRIES))
+
+        for frame_address in missing:
+            frame_length = min(MAX_PAYLOAD, address + length - frame_address)
+            frames.update(request_range(sp, frame_address, frame_length, compress))
+
+    return b''.join(frames[frame_address] for frame_address in range(address, address + length, MAX_PAYLOAD))
+
+
 def usage():
     print("usage: {} <serial_port> <bootloader_filename>".format(sys.argv[0]))
+    print("       {} <serial_port> <output_filename> <address> <length> [compress]".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
 
+    # Ensure we have proper-ish arguments.
+    if len(sys.argv) not in (3, 5, 6) or (len(sys.argv) == 6 and sys.argv[5] != 'compress'):
+        usage()
+        sys.exit(0)
 
-# Ensure we have proper-ish arguments.
-if len(sys.argv) != 3:
-    usage()
-    sys.exit(0)
+    serial_port = sys.argv[1]
+    out_file    = sys.argv[2]
 
-serial_port = sys.argv[1]
-out_file    = sys.argv[2]
+    # If we've been given a range, fetch it using the binary protocol.
+    if len(sys.argv) >= 5:
+        data = read_memory_binary(serial_port, int(sys.argv[3], 0), int(sys.argv[4], 0), len(sys.argv) == 6)
 
-# Read the bootloader into an intel hex file...
-raw_ihex = read_bootloader_ihex(sys.argv[1])
+        with open(out_file, 'wb') as f:
+            f.write(data)
 
-# ... and produce the output binary.
-ihex = IntelHex(StringIO(raw_ihex))
-ihex.tobinfile(out_file)
+        sys.exit(0)
 
+    # Read the bootloader into an intel hex file...
+    raw_ihex = read_bootloader_ihex(sys.argv[1])
 
+    # ... and produce the output binary.
+    ihex = IntelHex(StringIO(raw_ihex))
+    ihex.tobinfile(out_file)
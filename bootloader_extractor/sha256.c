@@ -0,0 +1,153 @@
+/*
+ * SHA-256 for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+/**
+ * The round constants, as given in FIPS 180-4. Kept const so they live in
+ * flash rather than taking up RAM.
+ */
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t load_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/**
+ * Runs the compression function over a single 64-byte block.
+ */
+static void process_block(uint32_t *state, const uint8_t *block)
+{
+    uint32_t schedule[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for(int i = 0; i < 16; ++i)
+        schedule[i] = load_be32(block + 4 * i);
+
+    for(int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROR(schedule[i - 15], 7) ^ ROR(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+        uint32_t s1 = ROR(schedule[i - 2], 17) ^ ROR(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+    for(int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+            round_constants[i] + schedule[i];
+        uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(struct sha256_context *context)
+{
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(context->state, initial_state, sizeof(initial_state));
+    context->length = 0;
+    context->block_used = 0;
+}
+
+void sha256_update(struct sha256_context *context, const void *data, size_t len)
+{
+    const uint8_t *pos = data;
+
+    context->length += len;
+
+    // Top up any partial block we're holding first...
+    if(context->block_used) {
+        size_t chunk = SHA256_BLOCK_SIZE - context->block_used;
+
+        if(chunk > len)
+            chunk = len;
+
+        memcpy(context->block + context->block_used, pos, chunk);
+        context->block_used += chunk;
+        pos += chunk;
+        len -= chunk;
+
+        if(context->block_used < SHA256_BLOCK_SIZE)
+            return;
+
+        process_block(context->state, context->block);
+        context->block_used = 0;
+    }
+
+    // ... then work straight from the source for as long as we can ...
+    for(; len >= SHA256_BLOCK_SIZE; pos += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE)
+        process_block(context->state, pos);
+
+    // ... and hold on to whatever's left.
+    memcpy(context->block, pos, len);
+    context->block_used = len;
+}
+
+void sha256_finish(struct sha256_context *context, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bit_length = context->length * 8;
+    size_t used = context->block_used;
+
+    // Terminate the message, leaving room for its length at the end of a block.
+    context->block[used++] = 0x80;
+
+    if(used > SHA256_BLOCK_SIZE - 8) {
+        memset(context->block + used, 0, SHA256_BLOCK_SIZE - used);
+        process_block(context->state, context->block);
+        used = 0;
+    }
+
+    memset(context->block + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+    store_be32(context->block + SHA256_BLOCK_SIZE - 8, bit_length >> 32);
+    store_be32(context->block + SHA256_BLOCK_SIZE - 4, bit_length);
+    process_block(context->state, context->block);
+
+    for(int i = 0; i < 8; ++i)
+        store_be32(digest + 4 * i, context->state[i]);
+}
@@ -0,0 +1,49 @@
+/*
+ * SHA-256 for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE (32)
+#define SHA256_BLOCK_SIZE (64)
+
+/**
+ * A SHA-256 computation in progress.
+ */
+struct sha256_context {
+    uint32_t state[8];
+    uint64_t length;
+
+    // Input that doesn't yet make up a whole block.
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t block_used;
+};
+
+void sha256_init(struct sha256_context *context);
+void sha256_update(struct sha256_context *context, const void *data, size_t len);
+
+/**
+ * Pads out the message, and produces its digest. The context must be
+ * initialized again before it's reused.
+ */
+void sha256_finish(struct sha256_context *context, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
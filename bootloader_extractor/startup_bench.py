@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Reboots between the extractor and the DFU bootloader over and over, and
+reports how long each takes to come up.
+
+Both programs record when they turned on their USB pull-up, and when the
+host configured them, in milliseconds since reset (see usb_connect.h in the
+firmware); the extractor reports these with its 'u' command, and the DFU
+bootloader with a vendor request (which needs pyusb). Alongside the
+host-side time for each to enumerate, these are summarized over all the
+runs, with a count of runs where a device never came back -- the failures
+a too-short USB_DISCONNECT_MS would bring on.
+"""
+
+import statistics
+import struct
+import sys
+import time
+
+from serial import Serial, SerialException
+
+from dfu_cycle import DFU_ID, to_app, to_dfu
+
+DEFAULT_RUNS          = 20
+
+# The DFU bootloader's vendor request for its startup times; see usbdfu.c.
+REQUEST_STARTUP_TIMES = 0x03
+VENDOR_IN             = 0xC0
+STARTUP_TIMES         = struct.Struct('<II')
+
+# How long to keep trying the extractor's serial port once it's back.
+OPEN_SECONDS          = 2.0
+
+
+def read_dfu_times():
+    """
+    return: The DFU bootloader's (pull-up, configured) times, in ms.
+    """
+
+    import usb.core
+
+    dev = usb.core.find(idVendor=int(DFU_ID[0], 16), idProduct=int(DFU_ID[1], 16))
+    if dev is None:
+        raise IOError("no DFU bootloader attached")
+
+    return STARTUP_TIMES.unpack(bytes(dev.ctrl_transfer(VENDOR_IN, REQUEST_STARTUP_TIMES, 0, 0, STARTUP_TIMES.size)))
+
+
+def read_app_times(serial_port):
+    """
+    return: The extractor's (pull-up, configured) times, in ms.
+    """
+
+    end = time.time() + OPEN_SECONDS
+    while True:
+        try:
+            sp = Serial(serial_port, timeout=1)
+            break
+        except SerialException:
+            if time.time() > end:
+                raise
+            time.sleep(0.05)
+
+    sp.reset_input_buffer()
+    sp.write(b'u\r')
+    words = sp.readline().decode(errors='replace').split()
+    sp.close()
+
+    # "startup: pullup X configured X", in hex.
+    if len(words) != 5 or words[0] != 'startup:':
+        raise IOError("unexpected reply from device: {!r}".format(' '.join(words)))
+
+    return int(words[2], 16), int(words[4], 16)
+
+
+def summarize(program, metric, values):
+    if not values:
+        print("bench=startup program={} metric={} runs=0".format(program, metric))
+        return
+
+    print("bench=startup program={} metric={} runs={} min={:.1f} median={:.1f} max={:.1f}".format(
+        program, metric, len(values), min(values), statistics.median(values), max(values)))
+
+
+def usage():
+    print("usage: {} <serial_port> [runs]".format(sys.argv[0]))
+    print("       starting with the extractor running")
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) not in (2, 3):
+        usage()
+        sys.exit(0)
+
+    serial_port = sys.argv[1]
+    runs = int(sys.argv[2]) if len(sys.argv) == 3 else DEFAULT_RUNS
+
+    results = {'dfu': {'pullup_ms': [], 'configured_ms': [], 'host_ms': []},
+               'app': {'pullup_ms': [], 'configured_ms': [], 'host_ms': []}}
+    failures = {'dfu': 0, 'app': 0}
+
+    for _ in range(runs):
+        seconds = to_dfu(serial_port)
+        if seconds is None:
+            failures['dfu'] += 1
+            break
+
+        pullup, configured = read_dfu_times()
+        results['dfu']['pullup_ms'].append(pullup)
+        results['dfu']['configured_ms'].append(configured)
+        results['dfu']['host_ms'].append(seconds * 1000)
+
+        _, seconds = to_app(serial_port)
+        if seconds is None:
+            failures['app'] += 1
+            break
+
+        pullup, configured = read_app_times(serial_port)
+        results['app']['pullup_ms'].append(pullup)
+        results['app']['configured_ms'].append(configured)
+        results['app']['host_ms'].append(seconds * 1000)
+
+    for program in ('dfu', 'app'):
+        for metric in ('pullup_ms', 'configured_ms', 'host_ms'):
+            summarize(program, metric, results[program][metric])
+
+    print("bench=startup runs={} dfu_failures={} app_failures={}".format(runs, failures['dfu'], failures['app']))
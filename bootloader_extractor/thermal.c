@@ -0,0 +1,224 @@
+/*
+ * Thermal frame streaming for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "bindump.h"
+#include "console.h"
+#include "crc32.h"
+#include "thermal.h"
+#include "timebase.h"
+
+/**
+ * The double buffer: the producer fills one segment of lines while we send
+ * the other. Each segment is as many whole lines as fit in a frame's payload.
+ */
+#define THERMAL_LINE_SIZE (THERMAL_WIDTH * 2)
+#define THERMAL_SEGMENT_LINES (BINDUMP_MAX_PAYLOAD / THERMAL_LINE_SIZE)
+#define THERMAL_SEGMENT_SIZE (THERMAL_SEGMENT_LINES * THERMAL_LINE_SIZE)
+#define THERMAL_SEGMENTS_PER_FRAME (THERMAL_HEIGHT / THERMAL_SEGMENT_LINES)
+
+#if THERMAL_HEIGHT % THERMAL_SEGMENT_LINES
+#error "Frames must be a whole number of segments."
+#endif
+
+// A THERMAL_END frame's payload.
+#define THERMAL_END_SIZE (8)
+
+// Room for a segment's frame, and the frame that may end after it.
+#define THERMAL_STEP_ROOM (BINDUMP_MAX_FRAME_SIZE + BINDUMP_HEADER_SIZE + THERMAL_END_SIZE + BINDUMP_TRAILER_SIZE)
+
+static uint16_t segments[2][THERMAL_SEGMENT_LINES * THERMAL_WIDTH];
+
+/**
+ * The number of lines produced since the stream started; only ever
+ * incremented, by the producer.
+ */
+static volatile uint32_t lines_produced;
+
+/**
+ * When the producer started each of the last two frames; a frame's
+ * timestamp is needed until its END is sent, by which time the producer
+ * can be no more than one frame further on.
+ */
+static volatile uint32_t frame_timestamps[2];
+
+/**
+ * Our progress through the frames: the segments we've finished sending, and
+ * the CRC of the current frame so far.
+ */
+static uint32_t segments_sent;
+static uint32_t frame_crc;
+
+static uint16_t sequence;
+
+static struct thermal_stats stats;
+
+
+/**
+ * The producer: fills in the next line of the synthetic pattern, as a
+ * sensor driver would copy in the next VoSPI packet.
+ */
+void tim4_isr(void)
+{
+    uint32_t line = lines_produced;
+    uint32_t frame_number = line / THERMAL_HEIGHT;
+    uint32_t y = line % THERMAL_HEIGHT;
+    uint16_t *pixels = &segments[(line / THERMAL_SEGMENT_LINES) & 1][(line % THERMAL_SEGMENT_LINES) * THERMAL_WIDTH];
+
+    timer_clear_flag(TIM4, TIM_SR_UIF);
+
+    if(!y)
+        frame_timestamps[frame_number & 1] = timebase_now_ms();
+
+    for(uint32_t x = 0; x < THERMAL_WIDTH; ++x)
+        pixels[x] = THERMAL_SYNTHETIC_PIXEL(frame_number, x, y);
+
+    lines_produced = line + 1;
+}
+
+/**
+ * Sets up TIM4 to interrupt as close to the given rate as it can.
+ *
+ * @return The rate it'll actually run at.
+ */
+static uint32_t setup_timer(uint32_t rate)
+{
+    // TIM4's clock is twice APB1's whenever APB1 is divided down, as it is at 72MHz.
+    uint32_t clock = rcc_apb1_frequency * 2;
+    uint32_t ticks = (clock + rate / 2) / rate;
+    uint32_t prescaler = (ticks - 1) / 0x10000;
+    uint32_t period = ticks / (prescaler + 1);
+
+    rcc_periph_clock_enable(RCC_TIM4);
+    rcc_periph_reset_pulse(RST_TIM4);
+
+    timer_set_prescaler(TIM4, prescaler);
+    timer_set_period(TIM4, period - 1);
+    timer_enable_irq(TIM4, TIM_DIER_UIE);
+    nvic_enable_irq(NVIC_TIM4_IRQ);
+
+    return clock / ((prescaler + 1) * period);
+}
+
+void thermal_start(uint32_t frame_rate)
+{
+    uint8_t announcement[12];
+    uint16_t width = THERMAL_WIDTH, height = THERMAL_HEIGHT;
+    uint32_t now = timebase_now_ms();
+
+    if(frame_rate > THERMAL_MAX_RATE)
+        frame_rate = THERMAL_MAX_RATE;
+    if(frame_rate == 0)
+        frame_rate = 1;
+
+    memset(&stats, 0, sizeof(stats));
+    lines_produced = 0;
+    segments_sent = 0;
+    frame_crc = CRC32_INIT;
+    sequence = 0;
+
+    stats.line_rate = setup_timer(frame_rate * THERMAL_HEIGHT);
+
+    memcpy(announcement, &width, 2);
+    memcpy(announcement + 2, &height, 2);
+    memcpy(announcement + 4, &stats.line_rate, 4);
+    memcpy(announcement + 8, &now, 4);
+    bindump_send_frame(BINDUMP_FRAME_THERMAL_START, sequence++, 0, announcement, sizeof(announcement));
+
+    timer_enable_counter(TIM4);
+}
+
+void thermal_stop(void)
+{
+    timer_disable_counter(TIM4);
+    nvic_disable_irq(NVIC_TIM4_IRQ);
+}
+
+/**
+ * If the producer has lapped us, gives up on the frame we're in, and skips
+ * ahead to the start of the first frame it hasn't started overwriting.
+ *
+ * @return True iff we had to skip anything.
+ */
+static bool catch_up(void)
+{
+    uint32_t filled = lines_produced / THERMAL_SEGMENT_LINES;
+    uint32_t resume;
+
+    // While it's filling the segment after ours, the one we're in is intact.
+    // (Having skipped ahead, we can be waiting on segments yet to come.)
+    if((int32_t)(filled - segments_sent) < 2)
+        return false;
+
+    // The oldest segment left intact is the last one filled.
+    resume = (filled - 1 + THERMAL_SEGMENTS_PER_FRAME - 1) / THERMAL_SEGMENTS_PER_FRAME;
+    stats.frames_dropped += resume - segments_sent / THERMAL_SEGMENTS_PER_FRAME;
+
+    segments_sent = resume * THERMAL_SEGMENTS_PER_FRAME;
+    frame_crc = CRC32_INIT;
+    return true;
+}
+
+void thermal_step(void)
+{
+    const uint16_t *pixels;
+    uint8_t end[THERMAL_END_SIZE];
+    uint32_t frame_number, timestamp;
+
+    catch_up();
+
+    if((int32_t)(lines_produced / THERMAL_SEGMENT_LINES - segments_sent) <= 0)
+        return;
+
+    // Only send what we're sure there's room for.
+    if(console_bytes_free() < THERMAL_STEP_ROOM)
+        return;
+
+    pixels = segments[segments_sent & 1];
+    bindump_send_frame(BINDUMP_FRAME_THERMAL_LINES, sequence++,
+            segments_sent * THERMAL_SEGMENT_LINES, pixels, THERMAL_SEGMENT_SIZE);
+    frame_crc = crc32_update(frame_crc, pixels, THERMAL_SEGMENT_SIZE);
+
+    // If the producer came back around while we were sending, what we sent
+    // may be a mix of two frames; the frame's lost, so don't end it.
+    if(catch_up())
+        return;
+
+    stats.bytes_sent += THERMAL_SEGMENT_SIZE;
+
+    if(++segments_sent % THERMAL_SEGMENTS_PER_FRAME)
+        return;
+
+    frame_number = segments_sent / THERMAL_SEGMENTS_PER_FRAME - 1;
+    timestamp = frame_timestamps[frame_number & 1];
+    memcpy(end, &timestamp, 4);
+    memcpy(end + 4, &frame_crc, 4);
+    bindump_send_frame(BINDUMP_FRAME_THERMAL_END, sequence++, frame_number, end, sizeof(end));
+
+    ++stats.frames_sent;
+    frame_crc = CRC32_INIT;
+}
+
+const struct thermal_stats *thermal_get_stats(void)
+{
+    return &stats;
+}
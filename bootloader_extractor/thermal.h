@@ -0,0 +1,97 @@
+/*
+ * Thermal frame streaming for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#include <stdint.h>
+
+/*
+ * Streams frames the size of the Lepton's (80x60, 16 bits a pixel) to the
+ * host. A producer interrupt fills a double buffer a few lines at a time,
+ * as the Lepton's VoSPI packets would arrive, while we send the other half;
+ * until there's a driver for the sensor, a timer stands in for it with a
+ * synthetic pattern. Two whole frames wouldn't fit in our RAM, so the
+ * halves are just big enough for a binary dump frame each (see bindump.h):
+ *
+ *   THERMAL_START: sent once; address zero, and a payload of
+ *       u16 width, u16 height, u32 line rate in Hz, u32 the time we
+ *       started, in milliseconds on the timebase
+ *
+ *   THERMAL_LINES: address is the index of the frame's first line,
+ *       counting from zero at the start of the stream (so its frame
+ *       number is the index over the height); the payload is whole lines
+ *       of pixels, each a u16
+ *
+ *   THERMAL_END: sent after a frame's last lines; address is the frame's
+ *       number, and the payload is u32 the time its first line was
+ *       produced (as in THERMAL_START), and u32 the CRC-32 of all of its
+ *       pixels, as for crc32_update
+ *
+ * Multi-byte fields are little-endian. If we fall behind, and the producer
+ * overwrites lines we haven't sent, the rest of that frame is dropped, and
+ * we pick up again at the start of the next; frames without an END are
+ * incomplete, and the host sees the gap in frame numbers.
+ *
+ * The synthetic pattern is a diagonal ramp that moves a pixel each frame:
+ * the pixel at (x, y) in frame n is THERMAL_SYNTHETIC_PIXEL(n, x, y), which
+ * lets the host check every pixel as well as the CRC.
+ */
+
+#define THERMAL_WIDTH  (80)
+#define THERMAL_HEIGHT (60)
+
+#define THERMAL_SYNTHETIC_PIXEL(frame, x, y) ((uint16_t)(0x2000 + ((((x) + (y) + (frame)) & 0xFF) << 4)))
+
+// The fastest frame rate we'll try; at 9600 bytes a frame, faster than USB
+// full speed can keep up with. thermal_rx.py reports what's achieved.
+#define THERMAL_MAX_RATE (100)
+
+/**
+ * Running statistics for the current (or last) stream.
+ */
+struct thermal_stats {
+    uint32_t line_rate;
+    uint32_t frames_sent;
+    uint32_t bytes_sent;
+
+    // Frames we fell too far behind to send all of.
+    uint32_t frames_dropped;
+};
+
+/**
+ * Starts producing frames at the closest rate to the one asked for that the
+ * timer can manage, and announces the stream to the host.
+ */
+void thermal_start(uint32_t frame_rate);
+
+/**
+ * Sends the next few lines, once they're ready and the console has room
+ * for them, and ends each frame as it's completed. Never finishes on its
+ * own; the stream runs until thermal_stop.
+ */
+void thermal_step(void);
+
+/**
+ * Stops the producer, ending the stream.
+ */
+void thermal_stop(void);
+
+const struct thermal_stats *thermal_get_stats(void);
+
+#endif
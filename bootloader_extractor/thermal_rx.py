@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""
+Receives thermal frames from the extractor's frame streaming mode ('f').
+
+Reassembles each frame from its lines, checks it against its CRC and
+against the synthetic pattern the extractor stands in for the sensor with,
+and reports the frame rate achieved, the frames dropped along the way, and
+the latency of each frame: from when the device produced its first line to
+when its last arrived here. Optionally, saves the good frames as raw 16-bit
+little-endian pixels, one after another. See thermal.h in the firmware for
+the stream format.
+"""
+
+import statistics
+import struct
+import sys
+import time
+import zlib
+
+from serial import Serial
+
+from rx_bootloader import read_frame
+
+FRAME_THERMAL_START = 0x09
+FRAME_THERMAL_LINES = 0x0A
+FRAME_THERMAL_END   = 0x0B
+
+THERMAL_START       = struct.Struct('<HHII')
+THERMAL_END         = struct.Struct('<II')
+
+CANCEL              = b'\x03'
+
+# The Lepton's frame rate, for when we're not asked for another.
+DEFAULT_RATE        = 9
+
+
+def synthetic_frame(number, width, height):
+    """
+    return: The pixels the device's stand-in for the sensor produces for the
+            given frame; see THERMAL_SYNTHETIC_PIXEL.
+    """
+
+    pixels = [0x2000 + (((x + y + number) & 0xFF) << 4) for y in range(height) for x in range(width)]
+    return struct.pack('<{}H'.format(len(pixels)), *pixels)
+
+
+class Stream:
+    """
+    The frames received from a single stream.
+    """
+
+    def __init__(self, output=None):
+        self.width = None
+        self.height = None
+        self.line_rate = None
+        self.output = output
+
+        self.good = 0
+        self.dropped = 0
+        self.incomplete = 0
+        self.crc_errors = 0
+        self.pattern_errors = 0
+        self.latencies = []
+        self.arrivals = []
+
+        self._offset = None
+        self._frame = None
+        self._pixels = None
+        self._lines = 0
+        self._damaged = False
+        self._last_end = None
+        self._patterns = {}
+
+    def add_frame(self, frame_type, address, payload, arrival):
+        if frame_type == FRAME_THERMAL_START and payload is not None:
+            self.width, self.height, self.line_rate, start_ms = THERMAL_START.unpack(payload[:THERMAL_START.size])
+
+            # Line up the device's clock with ours, as of the start; this
+            # frame went out with nothing ahead of it.
+            self._offset = arrival * 1000 - start_ms
+            return
+
+        if self.width is None:
+            return
+
+        # A damaged frame spoils whichever frame it was part of.
+        if payload is None:
+            self._damaged = True
+            return
+
+        line_size = self.width * 2
+
+        if frame_type == FRAME_THERMAL_LINES:
+            frame, line = divmod(address, self.height)
+            if frame != self._frame:
+                self._start_frame(frame)
+
+            self._pixels[line * line_size:line * line_size + len(payload)] = payload
+            self._lines += len(payload) // line_size
+
+        elif frame_type == FRAME_THERMAL_END:
+            timestamp_ms, crc = THERMAL_END.unpack(payload[:THERMAL_END.size])
+            self._end_frame(address, timestamp_ms, crc, arrival)
+
+    def _start_frame(self, frame):
+        self._frame = frame
+        self._pixels = bytearray(self.width * self.height * 2)
+        self._lines = 0
+        self._damaged = False
+
+    def _end_frame(self, frame, timestamp_ms, crc, arrival):
+
+        # Frames we never saw the end of were dropped, by the device or on the way.
+        first = 0 if self._last_end is None else self._last_end + 1
+        self.dropped += frame - first
+        self._last_end = frame
+
+        if frame != self._frame or self._lines != self.height or self._damaged:
+            self.incomplete += 1
+            return
+
+        pixels = bytes(self._pixels)
+        if zlib.crc32(pixels) != crc:
+            self.crc_errors += 1
+            return
+
+        if pixels != self._pattern(frame):
+            self.pattern_errors += 1
+
+        self.good += 1
+        self.arrivals.append(arrival)
+        self.latencies.append(arrival * 1000 - self._offset - timestamp_ms)
+
+        if self.output:
+            self.output.write(pixels)
+
+    def _pattern(self, frame):
+        key = frame & 0xFF
+        if key not in self._patterns:
+            self._patterns[key] = synthetic_frame(key, self.width, self.height)
+        return self._patterns[key]
+
+    def frame_rate(self):
+        if len(self.arrivals) < 2:
+            return 0
+        return (len(self.arrivals) - 1) / (self.arrivals[-1] - self.arrivals[0])
+
+
+def device_stats(sp):
+    """
+    Asks the device for its statistics on the last stream.
+
+    return: A dictionary of the values it reported.
+    """
+
+    sp.reset_input_buffer()
+    sp.write(b'f\r')
+
+    # "frames: line_rate X sent X bytes X dropped X", in hex.
+    words = sp.readline().decode(errors='replace').split()
+    if not words or words[0] != 'frames:':
+        raise IOError("unexpected reply from device: {!r}".format(' '.join(words)))
+
+    return {name: int(value, 16) for name, value in zip(words[1::2], words[2::2])}
+
+
+def receive(sp, rate, seconds, output=None):
+    """
+    Streams frames for the given time.
+
+    return: A (Stream, device statistics) tuple.
+    """
+
+    result = Stream(output)
+
+    sp.write(CANCEL + b'\r')
+    time.sleep(0.1)
+    sp.reset_input_buffer()
+
+    sp.write('f {}\r'.format(rate).encode())
+
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        result.add_frame(frame_type, address, payload, time.monotonic())
+
+    # Stop the stream, and take whatever's still on its way.
+    sp.write(CANCEL)
+    while True:
+        frame = read_frame(sp)
+        if frame is None:
+            break
+
+        frame_type, _, address, payload = frame
+        result.add_frame(frame_type, address, payload, time.monotonic())
+
+    return (result, device_stats(sp))
+
+
+def usage():
+    print("usage: {} <serial_port> <seconds> [rate [raw_filename]]".format(sys.argv[0]))
+    print("       rate is in frames per second; default {}".format(DEFAULT_RATE))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) not in (3, 4, 5):
+        usage()
+        sys.exit(0)
+
+    sp = Serial(sys.argv[1], timeout=1)
+    rate = int(sys.argv[3], 0) if len(sys.argv) >= 4 else DEFAULT_RATE
+    output = open(sys.argv[4], 'wb') if len(sys.argv) == 5 else None
+
+    result, stats = receive(sp, rate, float(sys.argv[2]), output)
+
+    if output:
+        output.close()
+
+    print("bench=thermal rate={} line_rate={} frames={} frames_per_second={:.2f} dropped={} incomplete={} crc_errors={} pattern_errors={} device_dropped={}".format(
+        rate, result.line_rate, result.good, result.frame_rate(), result.dropped, result.incomplete,
+        result.crc_errors, result.pattern_errors, stats['dropped']))
+
+    if result.latencies:
+        print("bench=thermal metric=latency_ms min={:.1f} median={:.1f} max={:.1f}".format(
+            min(result.latencies), statistics.median(result.latencies), max(result.latencies)))
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""
+Reads the event trace, which survives resets, from either of our programs.
+
+From the extractor, it comes from its 'e' command; from the DFU bootloader,
+from a vendor request (which needs pyusb). Events are printed oldest first,
+numbered by the boot they happened in, counting back from this one (boot=0)
+-- so after a hang and a long press, the events with boot=-1 show what was
+going on. See trace.h in the firmware.
+"""
+
+import struct
+import sys
+
+DFU_ID             = (0x0483, 0xdf11)
+
+# The DFU bootloader's vendor request for the trace; see usbdfu.c.
+REQUEST_TRACE_READ = 0x04
+VENDOR_IN          = 0xC0
+
+# struct trace_record: timestamp_ms, event, sequence, a, b.
+RECORD             = struct.Struct('<IHHII')
+TRACE_RECORDS      = 32
+
+# enum trace_event, and friends.
+EVENTS             = {1: 'boot', 2: 'reset', 3: 'usb_configured', 4: 'command',
+                      5: 'flash_erase', 6: 'flash_program'}
+PROGRAMS           = {1: 'extractor', 2: 'dfu'}
+RESET_REASONS      = {1: 'long_press', 2: 'command', 3: 'detach', 4: 'manifest'}
+BOOT_REQUESTS      = {0xDF11: 'dfu', 0xA1F0: 'extractor'}
+
+# The reset flags in RCC_CSR.
+RESET_FLAGS        = ((26, 'pin'), (27, 'power'), (28, 'software'), (29, 'iwdg'), (30, 'wwdg'), (31, 'low_power'))
+
+
+def read_dfu():
+    """
+    return: The trace from the DFU bootloader, as (timestamp, event, sequence, a, b) tuples.
+    """
+
+    import usb.core
+
+    dev = usb.core.find(idVendor=DFU_ID[0], idProduct=DFU_ID[1])
+    if dev is None:
+        raise IOError("no DFU bootloader attached")
+
+    # Our requests are only handled once the device is configured.
+    try:
+        dev.get_active_configuration()
+    except usb.core.USBError:
+        dev.set_configuration()
+
+    data = bytes(dev.ctrl_transfer(VENDOR_IN, REQUEST_TRACE_READ, 0, 0, RECORD.size * TRACE_RECORDS))
+    return [RECORD.unpack_from(data, pos) for pos in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+
+
+def read_extractor(serial_port):
+    """
+    return: The trace from the extractor, as (timestamp, event, sequence, a, b) tuples.
+    """
+
+    from serial import Serial
+
+    sp = Serial(serial_port, timeout=0.5)
+    sp.reset_input_buffer()
+    sp.write(b'e\r')
+
+    records = []
+    while True:
+        words = sp.readline().decode(errors='replace').split()
+        if not words:
+            break
+
+        # "trace: seq X ms X event X a X b X", all in hex.
+        if len(words) != 11 or words[0] != 'trace:':
+            continue
+
+        values = {key: int(value, 16) for key, value in zip(words[1::2], words[2::2])}
+        records.append((values['ms'], values['event'], values['seq'], values['a'], values['b']))
+
+    return records
+
+
+def describe(event, a, b):
+    """
+    return: The event's arguments, as key=value pairs.
+    """
+
+    if event == 1:
+        flags = [name for bit, name in RESET_FLAGS if a & (1 << bit)]
+        return "program={} reset_flags={}".format(PROGRAMS.get(b, b), ','.join(flags) or 'none')
+    if event == 2:
+        return "reason={} next={}".format(RESET_REASONS.get(a, a), BOOT_REQUESTS.get(b, 'buttons'))
+    if event == 3:
+        return "configuration={}".format(a)
+    if event == 4:
+        return "command={} argc={}".format(chr(a), b)
+    if event == 5:
+        return "address=0x{:08x}".format(a)
+    if event == 6:
+        return "address=0x{:08x} length={}".format(a, b)
+
+    return "a=0x{:08x} b=0x{:08x}".format(a, b)
+
+
+def usage():
+    print("usage: {} <serial_port>|dfu".format(sys.argv[0]))
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) != 2:
+        usage()
+        sys.exit(0)
+
+    records = read_dfu() if sys.argv[1] == 'dfu' else read_extractor(sys.argv[1])
+
+    # Number the boots so that ours is zero.
+    boot = -sum(1 for record in records if record[1] == 1)
+    previous_sequence = None
+
+    for timestamp, event, sequence, a, b in records:
+        if event == 1:
+            boot += 1
+
+        # Records lost to something trampling the RAM leave gaps.
+        if previous_sequence is not None and sequence != (previous_sequence + 1) & 0xffff:
+            print("bench=trace lost={}".format((sequence - previous_sequence - 1) & 0xffff))
+        previous_sequence = sequence
+
+        print("bench=trace boot={} seq={} ms={} event={} {}".format(
+            boot, sequence, timestamp, EVENTS.get(event, event), describe(event, a, b)))
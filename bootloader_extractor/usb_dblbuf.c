@@ -0,0 +1,277 @@
+/*
+ * Double-buffered USB bulk endpoints for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "usb_dblbuf.h"
+
+/*
+ * The USB peripheral's registers and packet memory, as described in
+ * RM0008. These are accessed directly, as libopencm3 doesn't know about
+ * double-buffered endpoints.
+ */
+#define USB_EPR(ep)             (*(volatile uint32_t *)(0x40005C00 + 4 * (ep)))
+#define USB_BTABLE              (*(volatile uint32_t *)0x40005C50)
+#define USB_PMA_BASE            (0x40006000)
+
+// Fields of each endpoint register.
+#define EPR_CTR_RX              (1 << 15)
+#define EPR_DTOG_RX             (1 << 14)
+#define EPR_STAT_RX             (3 << 12)
+#define EPR_STAT_RX_VALID       (3 << 12)
+#define EPR_EP_TYPE             (3 << 9)
+#define EPR_EP_KIND             (1 << 8)
+#define EPR_CTR_TX              (1 << 7)
+#define EPR_DTOG_TX             (1 << 6)
+#define EPR_STAT_TX             (3 << 4)
+#define EPR_STAT_TX_NAK         (2 << 4)
+#define EPR_STAT_TX_VALID       (3 << 4)
+#define EPR_EA                  (0xF)
+
+// The bits that read back as written; the DTOG and STAT bits instead toggle
+// when written with a one, and the CTR bits are cleared by writing a zero.
+#define EPR_RW_BITS             (EPR_EP_TYPE | EPR_EP_KIND | EPR_EA)
+
+// In double-buffered mode, the otherwise unused data toggle of the opposite
+// direction becomes the application's buffer flag (SW_BUF).
+#define EPR_SW_BUF_TX           EPR_DTOG_RX
+#define EPR_SW_BUF_RX           EPR_DTOG_TX
+
+// Each endpoint's buffer descriptor table entry; in double-buffered mode, the
+// TX and RX halves of the entry describe buffers 0 and 1, respectively.
+#define BTABLE_ADDR(ep, buffer) (USB_BTABLE + 8 * (ep) + 4 * (buffer))
+#define BTABLE_COUNT(ep, buffer) (BTABLE_ADDR(ep, buffer) + 2)
+
+// The received byte count, without the buffer size fields that share its word.
+#define COUNT_RX_MASK           (0x3FF)
+#define COUNT_RX_SIZE_MASK      (0xFC00)
+
+/**
+ * Returns the given halfword of packet memory. On the F1, each halfword of
+ * packet memory occupies a 32-bit word of the CPU's address space.
+ */
+static volatile uint32_t *pma(uint32_t offset)
+{
+    return (volatile uint32_t *)(USB_PMA_BASE + 2 * offset);
+}
+
+static void pma_write(uint16_t offset, const uint8_t *data, uint16_t len)
+{
+    volatile uint32_t *dest = pma(offset);
+
+    for(uint16_t i = 0; i < len; i += 2) {
+        uint16_t halfword = data[i];
+
+        if(i + 1 < len)
+            halfword |= data[i + 1] << 8;
+
+        *dest = halfword;
+        dest += 1;
+    }
+}
+
+static void pma_read(uint16_t offset, uint8_t *data, uint16_t len)
+{
+    volatile uint32_t *src = pma(offset);
+
+    for(uint16_t i = 0; i < len; i += 2) {
+        uint16_t halfword = *src;
+        src += 1;
+
+        data[i] = halfword & 0xFF;
+        if(i + 1 < len)
+            data[i + 1] = halfword >> 8;
+    }
+}
+
+/**
+ * Writes an endpoint register, toggling the given DTOG/STAT bits (and
+ * setting any of the given read/write bits), while leaving everything
+ * else -- including both CTR flags -- as it was.
+ */
+static void epr_write(uint8_t ep, uint32_t epr, uint32_t set_or_toggle)
+{
+    USB_EPR(ep) = (epr & EPR_RW_BITS) | EPR_CTR_RX | EPR_CTR_TX | set_or_toggle;
+}
+
+/**
+ * Clears the given CTR flag, and returns the endpoint's register as it stood
+ * after any transfers that flag was raised for.
+ *
+ * This keeps clearing until the flag stays clear, so a transfer completing
+ * while we look can never be both counted here (by its data toggle) and
+ * reported again later (by its CTR flag).
+ *
+ * @param raised Set iff the flag was raised when we started.
+ */
+static uint32_t claim_completions(uint8_t ep, uint32_t ctr, bool *raised)
+{
+    uint32_t epr = USB_EPR(ep);
+
+    *raised = epr & ctr;
+
+    while(epr & ctr) {
+        USB_EPR(ep) = ((epr & EPR_RW_BITS) | EPR_CTR_RX | EPR_CTR_TX) & ~ctr;
+        epr = USB_EPR(ep);
+    }
+
+    return epr;
+}
+
+/**
+ * Works out how many packets an OUT endpoint has received since we last
+ * looked. Each one toggles the peripheral's buffer flag, and it can't hold
+ * more than two, so an unchanged flag means either none or both -- and we
+ * know it's both if a completion was reported.
+ */
+static uint8_t count_received(uint8_t dtog, uint8_t last_dtog, bool completed, uint8_t room)
+{
+    uint8_t done;
+
+    if(dtog != last_dtog)
+        done = 1;
+    else
+        done = completed ? 2 : 0;
+
+    return (done > room) ? room : done;
+}
+
+void usb_dblbuf_in_init(struct usb_dblbuf_in *in, uint8_t ep, uint16_t second_buffer)
+{
+    uint32_t epr = USB_EPR(ep);
+
+    in->ep = ep;
+    in->queued = 0;
+
+    // Keep the buffer libopencm3 allocated as buffer 0, and add ours as buffer 1.
+    in->buffer[0] = *pma(BTABLE_ADDR(ep, 0));
+    in->buffer[1] = second_buffer;
+    *pma(BTABLE_ADDR(ep, 1)) = second_buffer;
+
+    // Switch to double buffering, with both buffer flags pointing at buffer 0:
+    // it's ours to fill, so the peripheral has to wait for it. Hold off
+    // transmitting until there's something to send.
+    epr_write(ep, epr, EPR_EP_KIND | (epr & (EPR_DTOG_TX | EPR_DTOG_RX)) |
+            ((epr & EPR_STAT_TX) ^ EPR_STAT_TX_NAK));
+}
+
+void usb_dblbuf_in_service(struct usb_dblbuf_in *in, bool completed)
+{
+    bool raised;
+    uint32_t epr = claim_completions(in->ep, EPR_CTR_TX, &raised);
+    uint8_t outstanding;
+
+    // The peripheral sends from the buffer its flag (DTOG_TX) points at, and
+    // toggles it as each packet goes out; we fill the buffer ours (SW_BUF)
+    // points at, and toggle it as we hand each one over. The peripheral
+    // waits whenever they point at the same buffer, so flags that differ
+    // mean it has exactly one packet left to send. Flags that match mean
+    // it's sent everything, or nothing of two: with two queued, it's only
+    // sent them if it's reported a completion since, as it can't have sent
+    // just one and left them matching. (Claiming completions as we look
+    // means every one reported is one we haven't yet seen in the flags.)
+    completed |= raised;
+
+    if(!!(epr & EPR_DTOG_TX) != !!(epr & EPR_SW_BUF_TX))
+        outstanding = 1;
+    else
+        outstanding = (in->queued == 2 && !completed) ? 2 : 0;
+
+    if(outstanding < in->queued)
+        in->queued = outstanding;
+}
+
+bool usb_dblbuf_in_can_write(const struct usb_dblbuf_in *in)
+{
+    return in->queued < 2;
+}
+
+void usb_dblbuf_in_write(struct usb_dblbuf_in *in, const void *data, uint16_t len)
+{
+    // Our buffer is whichever our flag points at; the peripheral never sends
+    // from it until we toggle the flag to hand it over.
+    uint32_t epr = USB_EPR(in->ep);
+    uint8_t buffer = !!(epr & EPR_SW_BUF_TX);
+
+    pma_write(in->buffer[buffer], data, len);
+    *pma(BTABLE_COUNT(in->ep, buffer)) = len;
+
+    // Hand it over right away, and make sure the peripheral's transmitting;
+    // if it's still sending the last packet, it'll move on to this one as
+    // soon as it's done, without waiting for us.
+    epr = USB_EPR(in->ep);
+    epr_write(in->ep, epr, EPR_SW_BUF_TX | ((epr & EPR_STAT_TX) ^ EPR_STAT_TX_VALID));
+
+    ++in->queued;
+}
+
+void usb_dblbuf_out_init(struct usb_dblbuf_out *out, uint8_t ep, uint16_t second_buffer)
+{
+    uint32_t epr = USB_EPR(ep);
+
+    out->ep = ep;
+    out->filled = 0;
+    out->next_read = 0;
+    out->last_dtog = 0;
+
+    // libopencm3 allocated the endpoint's buffer in the RX half of its table
+    // entry, which is buffer 1; ours goes in the TX half, as buffer 0, with
+    // the same size.
+    out->buffer[0] = second_buffer;
+    out->buffer[1] = *pma(BTABLE_ADDR(ep, 1));
+    *pma(BTABLE_ADDR(ep, 0)) = second_buffer;
+    *pma(BTABLE_COUNT(ep, 0)) = *pma(BTABLE_COUNT(ep, 1)) & COUNT_RX_SIZE_MASK;
+
+    // Switch to double buffering. The peripheral receives into buffer 0 first,
+    // while we hold on to buffer 1 until there's something to read.
+    epr_write(ep, epr, EPR_EP_KIND | (epr & EPR_DTOG_RX) |
+            ((epr & EPR_SW_BUF_RX) ^ EPR_SW_BUF_RX) |
+            ((epr & EPR_STAT_RX) ^ EPR_STAT_RX_VALID));
+}
+
+void usb_dblbuf_out_service(struct usb_dblbuf_out *out)
+{
+    bool raised;
+    uint32_t epr = claim_completions(out->ep, EPR_CTR_RX, &raised);
+    uint8_t dtog = !!(epr & EPR_DTOG_RX);
+
+    out->filled += count_received(dtog, out->last_dtog, raised, 2 - out->filled);
+    out->last_dtog = dtog;
+}
+
+bool usb_dblbuf_out_read(struct usb_dblbuf_out *out, void *data, uint16_t max_len, uint16_t *len)
+{
+    uint8_t buffer = out->next_read;
+    uint32_t epr;
+
+    if(!out->filled)
+        return false;
+
+    // Take the buffer we're about to read, giving the peripheral back the one
+    // we were holding, and make sure it's receiving.
+    epr = USB_EPR(out->ep);
+    epr_write(out->ep, epr, EPR_SW_BUF_RX | ((epr & EPR_STAT_RX) ^ EPR_STAT_RX_VALID));
+
+    *len = *pma(BTABLE_COUNT(out->ep, buffer)) & COUNT_RX_MASK;
+    if(*len > max_len)
+        *len = max_len;
+
+    pma_read(out->buffer[buffer], data, *len);
+
+    out->next_read ^= 1;
+    --out->filled;
+    return true;
+}
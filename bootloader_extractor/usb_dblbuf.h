@@ -0,0 +1,123 @@
+/*
+ * Double-buffered USB bulk endpoints for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __USB_DBLBUF_H__
+#define __USB_DBLBUF_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Double-buffered bulk endpoints for the STM32F1's USB peripheral, which
+ * libopencm3 doesn't support. Each endpoint is first set up with
+ * usbd_ep_setup as usual; these functions then give it a second packet
+ * buffer, and take over moving its data to and from packet memory.
+ *
+ * With two buffers, the next packet can be waiting in packet memory while
+ * the host is still reading (or sending) the current one.
+ */
+
+/**
+ * The state of a double-buffered IN endpoint.
+ *
+ * The peripheral sends from one buffer while the next packet is copied into
+ * the other; each packet is handed over as soon as it's copied, so the
+ * peripheral moves straight on to it once the first is sent, without
+ * waiting on us.
+ */
+struct usb_dblbuf_in {
+    uint8_t ep;
+
+    // Packet memory offsets of the two buffers.
+    uint16_t buffer[2];
+
+    // Packets handed to the peripheral that it may not have sent yet.
+    uint8_t queued;
+};
+
+/**
+ * The state of a double-buffered OUT endpoint.
+ *
+ * The peripheral receives into one buffer while we read the other.
+ */
+struct usb_dblbuf_out {
+    uint8_t ep;
+    uint16_t buffer[2];
+
+    // Packets received that we haven't read yet, and which buffer holds the
+    // oldest of them.
+    uint8_t filled;
+    uint8_t next_read;
+
+    // The peripheral's buffer flag (DTOG_RX), as of our last look.
+    uint8_t last_dtog;
+};
+
+/**
+ * Switches an IN endpoint set up by usbd_ep_setup over to double buffering.
+ *
+ * @param ep The endpoint number, without its direction bit.
+ * @param second_buffer Packet memory offset of a free buffer of the
+ *      endpoint's maximum packet size, to use as its second buffer.
+ */
+void usb_dblbuf_in_init(struct usb_dblbuf_in *in, uint8_t ep, uint16_t second_buffer);
+
+/**
+ * Catches up with the packets the peripheral has finished sending, freeing
+ * their buffers. Call this from the endpoint's transfer-complete callback,
+ * and from the main loop.
+ *
+ * @param completed True iff called because the peripheral reported a
+ *      completed transfer (whose flag the caller has already cleared).
+ */
+void usb_dblbuf_in_service(struct usb_dblbuf_in *in, bool completed);
+
+/**
+ * @return True iff there's a free buffer to write a packet into.
+ */
+bool usb_dblbuf_in_can_write(const struct usb_dblbuf_in *in);
+
+/**
+ * Copies a packet into the free buffer, and hands it straight to the
+ * peripheral to send once it's done with any before it. Only call this if
+ * usb_dblbuf_in_can_write says there's room.
+ */
+void usb_dblbuf_in_write(struct usb_dblbuf_in *in, const void *data, uint16_t len);
+
+/**
+ * Switches an OUT endpoint set up by usbd_ep_setup over to double buffering.
+ * Parameters are as for usb_dblbuf_in_init.
+ */
+void usb_dblbuf_out_init(struct usb_dblbuf_out *out, uint8_t ep, uint16_t second_buffer);
+
+/**
+ * Catches up with the packets the peripheral has received. Call this from
+ * the endpoint's transfer-complete callback, in place of reading a packet.
+ */
+void usb_dblbuf_out_service(struct usb_dblbuf_out *out);
+
+/**
+ * Reads the oldest received packet, handing its buffer back to the peripheral.
+ *
+ * @param len Receives the packet's length; packets longer than max_len are
+ *      truncated.
+ * @return False if there were no packets waiting.
+ */
+bool usb_dblbuf_out_read(struct usb_dblbuf_out *out, void *data, uint16_t max_len, uint16_t *len);
+
+#endif
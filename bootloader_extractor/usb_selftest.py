@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""
+Benchmarks the extractor's USB link using its 't' self-test commands.
+
+  source: the device streams a test pattern; we check it and time it.
+  sink:   we stream data to the device, which counts it and reports back.
+  echo:   we send short messages one at a time, and time each round trip.
+  idle:   we leave the device alone, and ask it how much of that time its
+          CPU was awake.
+
+Output is one line per test, as space-separated key=value pairs, so runs
+against different firmware builds can be compared directly.
+"""
+
+import re
+import sys
+import time
+
+from serial import Serial
+
+from log_decode import LogDecoder
+
+# The device's CPU clock, which its cycle counts are in.
+CPU_HZ          = 72000000
+
+# The bulk endpoints' packet size.
+PACKET_SIZE     = 64
+
+DEFAULT_LENGTH  = 1024 * 1024
+ECHO_MESSAGES   = 1000
+ECHO_SIZE       = 16
+
+# Large reads keep the host's per-call overhead out of the measurements.
+READ_SIZE       = 64 * 1024
+
+CANCEL          = b'\x03'
+
+# How long the idle test leaves the device alone.
+IDLE_SECONDS    = 2.0
+
+
+def report(test, **values):
+    print(' '.join(['bench=usb_selftest', 'test=' + test] +
+                   ['{}={}'.format(key, value) for key, value in values.items()]))
+
+
+def rates(length, elapsed):
+    """
+    return: Throughput for the given transfer as (MB/s, packets/ms) strings.
+    """
+
+    if not elapsed:
+        return ('inf', 'inf')
+
+    return ('{:.3f}'.format(length / elapsed / 1e6),
+            '{:.2f}'.format(length / PACKET_SIZE / elapsed / 1e3))
+
+
+def percentile(samples, fraction):
+    return samples[min(len(samples) - 1, int(len(samples) * fraction))]
+
+
+def test_source(sp, length):
+    """
+    Has the device stream length bytes of its test pattern (byte n is always
+    n & 0xFF), and times how long they take to arrive.
+    """
+
+    sp.write('t source {}\r'.format(length).encode())
+
+    # Start the clock on the first data to arrive, so the command's own latency
+    # isn't counted.
+    data = bytearray(sp.read(1))
+    start = time.monotonic()
+
+    while 0 < len(data) < length:
+        chunk = sp.read(min(READ_SIZE, length - len(data)))
+        if not chunk:
+            break
+        data += chunk
+
+    elapsed = time.monotonic() - start
+
+    errors = sum(1 for offset, byte in enumerate(data) if byte != offset & 0xFF)
+    mb_per_s, packets_per_ms = rates(len(data), elapsed)
+
+    report('source', length=length, received=len(data), errors=errors,
+           seconds='{:.3f}'.format(elapsed), mb_per_s=mb_per_s, packets_per_ms=packets_per_ms)
+    return len(data) == length and not errors
+
+
+def test_sink(sp, length):
+    """
+    Streams length bytes to the device, and times how long it takes to
+    consume them; both by our clock, and by the device's.
+    """
+
+    # Every byte value, cancel characters included: the sink takes it all as data.
+    block = bytes(i % 0x100 for i in range(READ_SIZE))
+
+    sp.write('t sink {}\r'.format(length).encode())
+    start = time.monotonic()
+
+    sent = 0
+    while sent < length:
+        sent += sp.write(block[:min(len(block), length - sent)])
+
+    line = sp.readline().decode(errors='replace')
+    elapsed = time.monotonic() - start
+
+    match = re.match(r'sink: ([0-9A-F]{8}) bytes in ([0-9A-F]{8}) cycles', line)
+    if not match:
+        report('sink', length=length, result='no_reply')
+        return False
+
+    received = int(match.group(1), 16)
+    device_seconds = int(match.group(2), 16) / CPU_HZ
+    mb_per_s, packets_per_ms = rates(received, elapsed)
+    device_mb_per_s, _ = rates(received, device_seconds)
+
+    report('sink', length=length, received=received, seconds='{:.3f}'.format(elapsed),
+           mb_per_s=mb_per_s, packets_per_ms=packets_per_ms, device_mb_per_s=device_mb_per_s)
+    return received == length
+
+
+def test_echo(sp, count, size):
+    """
+    Sends count messages of size bytes through the device's loopback, one
+    at a time, and reports the distribution of their round-trip times.
+    """
+
+    samples = []
+
+    sp.write(b't echo\r')
+
+    for i in range(count):
+        message = '{:0{}d}'.format(i, size).encode()[-size:]
+
+        start = time.monotonic()
+        sp.write(message)
+        reply = sp.read(size)
+        samples.append(time.monotonic() - start)
+
+        if reply != message:
+            report('echo', messages=i, result='mismatch')
+            return False
+
+    # Stop the loopback, and discard its acknowledgement.
+    sp.write(CANCEL)
+    sp.readline()
+    sp.readline()
+
+    samples.sort()
+    report('echo', messages=count, size=size,
+           **{name: '{:.1f}'.format(percentile(samples, fraction) * 1e6)
+              for name, fraction in (('p50_us', 0.50), ('p90_us', 0.90),
+                                     ('p99_us', 0.99), ('max_us', 1.0))})
+    return True
+
+
+def read_stats(sp, decoder):
+    """
+    Runs the 's' command, decoding its reply if it's been sent as deferred
+    log records.
+
+    return: The reply, as text.
+    """
+
+    sp.write(b's\r')
+    time.sleep(0.2)
+    data = sp.read(sp.in_waiting)
+
+    return decoder.feed(data) if decoder else data.decode(errors='replace')
+
+
+def test_idle(sp, decoder, seconds):
+    """
+    Leaves the device idle for a while, and reports the share of that time
+    its CPU was awake.
+    """
+
+    # The device reports its CPU use since the last 's', so start a new window...
+    read_stats(sp, decoder)
+    time.sleep(seconds)
+
+    # ... and see how it went.
+    match = re.search(r'cpu: (\d+)\.(\d)% active over ([0-9]+) ms', read_stats(sp, decoder))
+    if not match:
+        report('idle', result='no_reply')
+        return False
+
+    report('idle', ms=match.group(3), cpu_active_pct='{}.{}'.format(match.group(1), match.group(2)))
+    return True
+
+
+if len(sys.argv) not in (2, 3, 4):
+    print("usage: {} <serial_port> [<length> [<extractor_elf>]]".format(sys.argv[0]))
+    print("       the ELF is needed to read the idle test's result from builds with deferred logging")
+    sys.exit(0)
+
+length = int(sys.argv[2], 0) if len(sys.argv) >= 3 else DEFAULT_LENGTH
+decoder = LogDecoder(sys.argv[3]) if len(sys.argv) == 4 else None
+
+sp = Serial(sys.argv[1], timeout=2)
+
+# Start from a clean slate: cancel anything running, and drop whatever it left.
+sp.write(CANCEL + b'\r')
+time.sleep(0.1)
+sp.reset_input_buffer()
+
+passed = test_source(sp, length)
+passed = test_sink(sp, length) and passed
+passed = test_echo(sp, ECHO_MESSAGES, ECHO_SIZE) and passed
+passed = test_idle(sp, decoder, IDLE_SECONDS) and passed
+
+sys.exit(0 if passed else 1)
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""
+Measures how fast the extractor can stream data to the host.
+
+Asks the device for a raw dump of a memory range, and reads it back as fast
+as the host will go, discarding the data. Output is one line per run, as
+space-separated key=value pairs, so runs against different firmware builds
+(e.g. with and without DBLBUF_IN) can be compared directly.
+"""
+
+import sys
+import time
+
+from serial import Serial
+
+# By default, stream all of flash.
+DEFAULT_ADDRESS = 0x08000000
+DEFAULT_LENGTH  = 0x80000
+
+# Large reads keep the host's per-call overhead out of the measurement.
+READ_SIZE       = 64 * 1024
+
+
+def measure(port_name, address, length):
+    """
+    Streams the given range from the device.
+
+    return: A (bytes received, seconds taken) tuple.
+    """
+
+    sp = Serial(port_name, timeout=1)
+
+    # Drop anything left over from earlier commands, so we only count the dump.
+    sp.reset_input_buffer()
+    sp.write('x 0x{:x} 0x{:x}\r'.format(address, length).encode())
+
+    # Start the clock on the first data to arrive, so the command's own latency
+    # isn't counted.
+    received = len(sp.read(1))
+    start = time.monotonic()
+
+    while received < length:
+        chunk = sp.read(min(READ_SIZE, length - received))
+        if not chunk:
+            break
+        received += len(chunk)
+
+    return (received, time.monotonic() - start)
+
+
+if len(sys.argv) not in (2, 4):
+    print("usage: {} <serial_port> [<address> <length>]".format(sys.argv[0]))
+    sys.exit(0)
+
+address = int(sys.argv[2], 0) if len(sys.argv) == 4 else DEFAULT_ADDRESS
+length  = int(sys.argv[3], 0) if len(sys.argv) == 4 else DEFAULT_LENGTH
+
+received, elapsed = measure(sys.argv[1], address, length)
+
+print("bench=usb_sink address=0x{:08x} length={} received={} seconds={:.3f} kb_per_s={:.1f}".format(
+    address, length, received, elapsed, received / 1024 / elapsed if elapsed else 0))
+
+sys.exit(0 if received == length else 1)
@@ -0,0 +1,105 @@
+/*
+ * Cycle-count instrumentation for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "instrument.h"
+
+#if INSTRUMENT_ENABLED
+
+#include <string.h>
+#include <libopencm3/cm3/cortex.h>
+
+#define INSTRUMENT_RECORD_FIXED_SIZE (20)
+
+/**
+ * Every region recorded so far. Regions can be recorded from interrupts, so
+ * the list and the statistics are only touched with them masked.
+ */
+static struct instrument_region *regions;
+
+
+void instrument_init(void)
+{
+    dwt_enable_cycle_counter();
+}
+
+void instrument_record(struct instrument_region *region, uint32_t cycles)
+{
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    if(!region->listed) {
+        region->next = regions;
+        regions = region;
+        region->listed = true;
+    }
+
+    if(!region->calls || cycles < region->min_cycles)
+        region->min_cycles = cycles;
+    if(cycles > region->max_cycles)
+        region->max_cycles = cycles;
+
+    ++region->calls;
+    region->total_cycles += cycles;
+
+    cm_mask_interrupts(was_masked);
+}
+
+const struct instrument_region *instrument_first(void)
+{
+    return regions;
+}
+
+void instrument_reset(void)
+{
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    // Keep the list as it is; cleared regions just start over.
+    for(struct instrument_region *region = regions; region; region = region->next) {
+        region->calls = 0;
+        region->min_cycles = 0;
+        region->max_cycles = 0;
+        region->total_cycles = 0;
+    }
+
+    cm_mask_interrupts(was_masked);
+}
+
+size_t instrument_serialize(uint8_t *buffer, size_t size)
+{
+    size_t pos = 0;
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    for(struct instrument_region *region = regions; region; region = region->next) {
+        size_t name_size = strlen(region->name) + 1;
+
+        if(pos + INSTRUMENT_RECORD_FIXED_SIZE + name_size > size)
+            break;
+
+        memcpy(&buffer[pos], &region->calls, 4);
+        memcpy(&buffer[pos + 4], &region->min_cycles, 4);
+        memcpy(&buffer[pos + 8], &region->max_cycles, 4);
+        memcpy(&buffer[pos + 12], &region->total_cycles, 8);
+        memcpy(&buffer[pos + INSTRUMENT_RECORD_FIXED_SIZE], region->name, name_size);
+
+        pos += INSTRUMENT_RECORD_FIXED_SIZE + name_size;
+    }
+
+    cm_mask_interrupts(was_masked);
+    return pos;
+}
+
+#endif
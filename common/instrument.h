@@ -0,0 +1,127 @@
+/*
+ * Cycle-count instrumentation for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INSTRUMENT_H__
+#define __INSTRUMENT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Times named regions of code with the DWT cycle counter, keeping a call
+ * count and the minimum, maximum and total cycles for each. A region is
+ * declared once per file, and can then be timed anywhere in it:
+ *
+ *     INSTRUMENT_REGION(usbd_poll);
+ *
+ *     INSTRUMENT_BEGIN(usbd_poll);
+ *     usbd_poll(usbdev);
+ *     INSTRUMENT_END(usbd_poll);
+ *
+ * Regions are timed on the wall clock, so any interrupt taken inside one is
+ * counted against it. All of this compiles away to nothing unless we're
+ * built with INSTRUMENT_ENABLED (the Makefiles' INSTRUMENT=1).
+ */
+
+#ifndef INSTRUMENT_ENABLED
+#define INSTRUMENT_ENABLED 0
+#endif
+
+/**
+ * The statistics for a single region. Each joins the list of regions the
+ * first time it's recorded, so the list is in order of first use.
+ */
+struct instrument_region {
+    const char *name;
+
+    uint32_t calls;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+
+    bool listed;
+    struct instrument_region *next;
+};
+
+#if INSTRUMENT_ENABLED
+
+#include <libopencm3/cm3/dwt.h>
+
+#define INSTRUMENT_REGION(region) \
+    static struct instrument_region instrument_region_##region = { .name = #region }
+
+#define INSTRUMENT_BEGIN(region) \
+    uint32_t instrument_start_##region = dwt_read_cycle_counter()
+
+#define INSTRUMENT_END(region) \
+    instrument_record(&instrument_region_##region, dwt_read_cycle_counter() - instrument_start_##region)
+
+/**
+ * Starts the cycle counter, if nothing else has.
+ */
+void instrument_init(void);
+
+/**
+ * Adds one call to a region's statistics; safe to call from interrupts.
+ */
+void instrument_record(struct instrument_region *region, uint32_t cycles);
+
+/**
+ * @return The first region recorded so far, or NULL if there are none; the
+ *      rest follow from its next pointer.
+ */
+const struct instrument_region *instrument_first(void);
+
+/**
+ * Clears every region's statistics, so a new measurement can be started.
+ */
+void instrument_reset(void);
+
+/**
+ * Packs every region's statistics into a buffer for the host; each is a
+ * u32 call count, u32 minimum, u32 maximum and u64 total (all little-endian
+ * and unaligned), then the region's name and a NUL. Regions that don't fit
+ * are left out.
+ *
+ * @return The number of bytes written.
+ */
+size_t instrument_serialize(uint8_t *buffer, size_t size);
+
+#else
+
+// Declares nothing; the bare struct tag only gives the semicolon that
+// follows something to end.
+#define INSTRUMENT_REGION(region) struct instrument_region
+#define INSTRUMENT_BEGIN(region) do {} while(0)
+#define INSTRUMENT_END(region) do {} while(0)
+
+static inline void instrument_init(void) {}
+static inline const struct instrument_region *instrument_first(void) { return NULL; }
+static inline void instrument_reset(void) {}
+
+static inline size_t instrument_serialize(uint8_t *buffer, size_t size)
+{
+    (void)buffer;
+    (void)size;
+    return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Cooperative scheduler for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "sched.h"
+#include "timebase.h"
+
+/**
+ * Every running timer. Interrupts can start and stop timers, so the list is
+ * only ever walked or changed with them masked.
+ */
+static struct sched_timer *timers;
+
+/**
+ * Counts calls to sched_run, so each can run every timer at most once.
+ */
+static uint32_t pass;
+
+
+static void unlink_timer(struct sched_timer *timer)
+{
+    for(struct sched_timer **link = &timers; *link; link = &(*link)->next) {
+        if(*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+
+    timer->active = false;
+}
+
+void sched_timer_start(struct sched_timer *timer, sched_func_t func,
+        uint32_t delay_ms, uint32_t period_ms)
+{
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    if(!timer->active) {
+        timer->next = timers;
+        timers = timer;
+        timer->active = true;
+    }
+
+    timer->func = func;
+    timer->due = timebase_now_ms() + delay_ms;
+    timer->period = period_ms;
+
+    cm_mask_interrupts(was_masked);
+}
+
+void sched_timer_stop(struct sched_timer *timer)
+{
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    if(timer->active)
+        unlink_timer(timer);
+
+    cm_mask_interrupts(was_masked);
+}
+
+/**
+ * Finds a timer that's due and hasn't run this pass, and claims it: a
+ * one-shot timer is stopped, and a periodic one is moved on to its next
+ * due time.
+ *
+ * @return The function to run, or NULL if nothing else is due.
+ */
+static sched_func_t claim_due_timer(uint32_t now)
+{
+    sched_func_t func = NULL;
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    for(struct sched_timer *timer = timers; timer; timer = timer->next) {
+        if(timer->last_pass == pass || !timebase_reached(now, timer->due))
+            continue;
+
+        func = timer->func;
+        timer->last_pass = pass;
+
+        if(!timer->period) {
+            unlink_timer(timer);
+            break;
+        }
+
+        // Keep to the period, unless we've fallen a whole period behind.
+        timer->due += timer->period;
+        if(timebase_reached(now, timer->due))
+            timer->due = now + timer->period;
+        break;
+    }
+
+    cm_mask_interrupts(was_masked);
+    return func;
+}
+
+void sched_run(void)
+{
+    uint32_t now = timebase_now_ms();
+    sched_func_t func;
+
+    ++pass;
+
+    // Work runs with interrupts unmasked, and may start or stop timers
+    // itself, so look for the next due timer afresh each time.
+    while((func = claim_due_timer(now)))
+        func();
+}
+
+bool sched_idle(void)
+{
+    uint32_t now = timebase_now_ms();
+    bool idle = true;
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    for(struct sched_timer *timer = timers; timer; timer = timer->next) {
+        if(timebase_reached(now, timer->due)) {
+            idle = false;
+            break;
+        }
+    }
+
+    cm_mask_interrupts(was_masked);
+    return idle;
+}
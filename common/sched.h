@@ -0,0 +1,97 @@
+/*
+ * Cooperative scheduler for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Runs work from the main loop at set times, on the timebase's millisecond
+ * tick. Each piece of work is a timer: one-shot or periodic, and stored by
+ * its owner, so there's nothing to allocate and no limit on how many there
+ * are. Deferred work is just a timer that's due right away; timers can be
+ * started and stopped from interrupts, so that's how they hand work off to
+ * the main loop.
+ *
+ * Work runs to completion, so it should be short; anything long belongs in a
+ * command job (see cmdline.h), which is run a step at a time.
+ */
+
+typedef void (*sched_func_t)(void);
+
+/**
+ * A scheduled piece of work. Owned by the caller; treat as opaque.
+ */
+struct sched_timer {
+    sched_func_t func;
+    uint32_t due;
+
+    // How often to run; zero for a one-shot timer.
+    uint32_t period;
+
+    // The sched_run pass that last ran this timer.
+    uint32_t last_pass;
+
+    bool active;
+    struct sched_timer *next;
+};
+
+/**
+ * Schedules func to run after delay_ms, and then every period_ms if that's
+ * non-zero. Restarts the timer if it's already running.
+ */
+void sched_timer_start(struct sched_timer *timer, sched_func_t func,
+        uint32_t delay_ms, uint32_t period_ms);
+
+/**
+ * Stops a timer, if it's running.
+ */
+void sched_timer_stop(struct sched_timer *timer);
+
+/**
+ * Schedules func to run every period_ms, starting a period from now.
+ */
+static inline void sched_every(struct sched_timer *timer, sched_func_t func, uint32_t period_ms)
+{
+    sched_timer_start(timer, func, period_ms, period_ms);
+}
+
+/**
+ * Schedules func to run from the main loop as soon as possible.
+ */
+static inline void sched_defer(struct sched_timer *timer, sched_func_t func)
+{
+    sched_timer_start(timer, func, 0, 0);
+}
+
+/**
+ * Runs all work that's due; called from the main loop. Each timer runs at
+ * most once per call, even if it's restarted meanwhile. A periodic timer
+ * that's fallen behind runs once, and then keeps to its period from then on.
+ */
+void sched_run(void);
+
+/**
+ * @return True iff no work is due, so the caller can sleep until the next
+ *      interrupt (at worst, the next tick).
+ */
+bool sched_idle(void);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Millisecond timebase for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+
+#include "timebase.h"
+
+static volatile uint32_t now_ms;
+static void (*volatile tick_handler)(void);
+
+
+void timebase_init(void)
+{
+    systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+    systick_set_reload(rcc_ahb_frequency / 1000 - 1);
+    systick_interrupt_enable();
+    systick_counter_enable();
+}
+
+void timebase_set_tick_handler(void (*handler)(void))
+{
+    tick_handler = handler;
+}
+
+uint32_t timebase_now_ms(void)
+{
+    return now_ms;
+}
+
+void sys_tick_handler(void)
+{
+    ++now_ms;
+
+    if(tick_handler)
+        tick_handler();
+}
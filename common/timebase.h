@@ -0,0 +1,57 @@
+/*
+ * Millisecond timebase for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A millisecond count driven by SysTick, shared by the programs we boot.
+ * The count wraps after about 49 days; compare times with timebase_reached
+ * or by subtraction, never directly.
+ */
+
+/**
+ * Starts the millisecond tick. Call again whenever the system clock
+ * changes, to keep the tick at a millisecond; the count carries on.
+ */
+void timebase_init(void);
+
+/**
+ * Sets a function for the tick interrupt to call every millisecond, or NULL
+ * for none. It runs even while the main loop is stuck, so it suits work
+ * that must not wait on it; keep it short.
+ */
+void timebase_set_tick_handler(void (*handler)(void));
+
+/**
+ * @return Milliseconds since timebase_init.
+ */
+uint32_t timebase_now_ms(void);
+
+/**
+ * @return True iff the given time (in timebase_now_ms terms) has come.
+ */
+static inline bool timebase_reached(uint32_t now, uint32_t time)
+{
+    return (int32_t)(now - time) >= 0;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Reset-surviving event trace for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "trace.h"
+
+// Left alone by the startup code, so it keeps whatever the last run wrote.
+struct trace_ring trace_ring __attribute__((section(".noinit")));
+
+
+void trace_init(enum trace_program program)
+{
+    uint32_t reset_flags = RCC_CSR & RCC_CSR_RESET_FLAGS;
+
+    // Clear the reset flags, so the next boot sees only its own reset.
+    RCC_CSR |= RCC_CSR_RMVF;
+
+    // At power-on, there's nothing worth keeping. The records' sequence
+    // numbers can't all match a head of zero, so whatever they hold is
+    // ignored until it's overwritten.
+    if(trace_ring.magic != TRACE_MAGIC) {
+        memset(trace_ring.records, 0, sizeof(trace_ring.records));
+        trace_ring.head = 0;
+        trace_ring.magic = TRACE_MAGIC;
+    }
+
+    trace(TRACE_BOOT, reset_flags, program);
+}
+
+/**
+ * @return True iff the given record is the one we last wrote in its place.
+ */
+static bool record_valid(uint32_t sequence)
+{
+    return trace_ring.records[sequence & (TRACE_RECORDS - 1)].sequence == (uint16_t)sequence;
+}
+
+size_t trace_read(void *buffer, size_t max_records)
+{
+    uint8_t *out = buffer;
+    size_t count = 0;
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    uint32_t head = trace_ring.head;
+    uint32_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+
+    // Skip forward until only as many valid records as fit are left.
+    size_t valid = 0;
+    for(uint32_t sequence = first; sequence != head; ++sequence)
+        valid += record_valid(sequence);
+
+    for(uint32_t sequence = first; sequence != head; ++sequence) {
+        if(!record_valid(sequence))
+            continue;
+
+        if(valid-- > max_records)
+            continue;
+
+        memcpy(&out[count++ * sizeof(struct trace_record)],
+                &trace_ring.records[sequence & (TRACE_RECORDS - 1)], sizeof(struct trace_record));
+    }
+
+    cm_mask_interrupts(was_masked);
+    return count;
+}
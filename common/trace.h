@@ -0,0 +1,152 @@
+/*
+ * Reset-surviving event trace for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "timebase.h"
+
+/*
+ * A small ring of binary events, kept in RAM that nothing initializes, so
+ * that it survives a warm reset -- a long press, a watchdog, or a reset
+ * into the other program. Both the extractor and the DFU bootloader keep
+ * the ring at the same address (see the .noinit section in their linker
+ * scripts), and carry on appending to it across resets, so whichever comes
+ * up next can show what the last one was doing before it went away.
+ *
+ * Each boot starts with a TRACE_BOOT event; everything before the newest
+ * one is from an earlier run. Recording an event is a handful of stores with
+ * interrupts masked, cheap enough to leave on everywhere.
+ *
+ * RAM isn't cleared by a reset, but nothing stops the FLIR bootloader --
+ * which runs before us -- from using it. Each record carries the low bits
+ * of its sequence number, and records whose number doesn't fit where they
+ * sit in the ring are dropped when reading it back; so is everything, if
+ * the header itself has been trampled.
+ */
+
+// The number of records in the ring; must be a power of two.
+#define TRACE_RECORDS (32)
+
+// Marks a ring we've set up, rather than whatever RAM held at power-on.
+#define TRACE_MAGIC (0x54524331)
+
+/**
+ * Events. These are shared by both programs and decoded by trace.py, so
+ * only ever add to the end.
+ */
+enum trace_event {
+
+    // We've just started. a = the RCC reset flags (RCC_CSR), b = which
+    // program we are (a trace_program).
+    TRACE_BOOT = 1,
+
+    // We're about to reset. a = why (a trace_reset_reason), b = the boot
+    // request we're leaving, if any.
+    TRACE_RESET,
+
+    // The host has configured us; a = the configuration.
+    TRACE_USB_CONFIGURED,
+
+    // The extractor is running a console command; a = its first character,
+    // b = how many arguments it has, itself included.
+    TRACE_COMMAND,
+
+    // The DFU bootloader is erasing the page at a.
+    TRACE_FLASH_ERASE,
+
+    // The DFU bootloader is programming b bytes at a.
+    TRACE_FLASH_PROGRAM,
+};
+
+enum trace_program {
+    TRACE_PROGRAM_EXTRACTOR = 1,
+    TRACE_PROGRAM_DFU,
+};
+
+enum trace_reset_reason {
+    TRACE_RESET_LONG_PRESS = 1,
+    TRACE_RESET_COMMAND,
+    TRACE_RESET_DETACH,
+    TRACE_RESET_MANIFEST,
+};
+
+struct trace_record {
+    uint32_t timestamp_ms;
+    uint16_t event;
+
+    // The low bits of this record's sequence number.
+    uint16_t sequence;
+
+    uint32_t a;
+    uint32_t b;
+};
+
+struct trace_ring {
+    uint32_t magic;
+
+    // The sequence number of the next record; counts up forever.
+    uint32_t head;
+
+    struct trace_record records[TRACE_RECORDS];
+};
+
+extern struct trace_ring trace_ring;
+
+/**
+ * Checks the ring left by the last run, starting a new one if there isn't a
+ * usable one, and records our boot. Call first thing in main().
+ */
+void trace_init(enum trace_program program);
+
+/**
+ * Copies out the newest records in the ring that are still valid, oldest
+ * first, each as it is in memory. Records lost to something else using the
+ * RAM are skipped; their sequence numbers show where.
+ *
+ * @param buffer Where to copy them; needn't be aligned.
+ * @param max_records The most records to copy.
+ * @return The number of records copied.
+ */
+size_t trace_read(void *buffer, size_t max_records);
+
+/**
+ * Records an event. Safe from any context.
+ */
+static inline void trace(enum trace_event event, uint32_t a, uint32_t b)
+{
+    uint32_t now = timebase_now_ms();
+    uint32_t was_masked = cm_mask_interrupts(1);
+
+    uint32_t sequence = trace_ring.head++;
+    struct trace_record *record = &trace_ring.records[sequence & (TRACE_RECORDS - 1)];
+
+    record->timestamp_ms = now;
+    record->event = event;
+    record->sequence = sequence;
+    record->a = a;
+    record->b = b;
+
+    cm_mask_interrupts(was_masked);
+}
+
+#endif
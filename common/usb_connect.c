@@ -0,0 +1,56 @@
+/*
+ * USB connection timing for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "timebase.h"
+#include "usb_connect.h"
+
+static struct usb_connect_times times;
+
+
+void usb_connect_init(void)
+{
+    rcc_periph_clock_enable(RCC_GPIOE);
+
+    // Start with the USB pull-up disabled, so we don't trigger a connection until we're ready.
+    gpio_set(GPIOE, GPIO0);
+    gpio_set_mode(GPIOE, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, GPIO0);
+}
+
+void usb_connect(void)
+{
+    // The tick wakes us every millisecond to check.
+    while(!timebase_reached(timebase_now_ms(), USB_CONNECT_DISCONNECT_MS))
+        __asm__("wfi");
+
+    gpio_clear(GPIOE, GPIO0);
+    times.pullup_ms = timebase_now_ms();
+}
+
+void usb_connect_configured(void)
+{
+    if(!times.configured_ms)
+        times.configured_ms = timebase_now_ms();
+}
+
+const struct usb_connect_times *usb_connect_get_times(void)
+{
+    return &times;
+}
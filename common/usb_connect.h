@@ -0,0 +1,76 @@
+/*
+ * USB connection timing for the TG165 alternate firmware.
+ *    Copyright (C) 2016 Kate J. Temkin <k@ktemkin.com>
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __USB_CONNECT_H__
+#define __USB_CONNECT_H__
+
+#include <stdint.h>
+
+/*
+ * Connects us to the host by turning on the D+ pull-up (on PE0, active
+ * low), and keeps track of how long that, and enumeration, took.
+ *
+ * When we've been reset from another program that was connected, the host
+ * has to see the pull-up go away, or it won't notice we've come back as a
+ * different device. So we hold it off for a minimum time after reset, long
+ * enough for the host to see a disconnect. That time is measured on the
+ * timebase, which must be started first thing in main() for "since reset"
+ * to mean much.
+ */
+
+// The least time the pull-up is held off after reset, in milliseconds. The
+// USB spec has hubs notice a disconnect within microseconds, but hosts take
+// their time acting on it; this is about what the old startup delay loop
+// gave, which is known to work. Only shorten it once startup_bench.py shows
+// a shorter time coming back reliably.
+#ifndef USB_CONNECT_DISCONNECT_MS
+#define USB_CONNECT_DISCONNECT_MS (50)
+#endif
+
+/**
+ * Milestones of our startup, in milliseconds on the timebase.
+ */
+struct usb_connect_times {
+
+    // When we turned on the pull-up.
+    uint32_t pullup_ms;
+
+    // When the host first configured us, or zero if it hasn't yet.
+    uint32_t configured_ms;
+};
+
+/**
+ * Sets the pull-up's GPIO up, with the pull-up off; call as early as
+ * possible.
+ */
+void usb_connect_init(void);
+
+/**
+ * Turns on the pull-up, first waiting out the rest of the minimum
+ * disconnect time if need be.
+ */
+void usb_connect(void);
+
+/**
+ * Notes that the host has configured us; call from the set-config callback.
+ */
+void usb_connect_configured(void);
+
+const struct usb_connect_times *usb_connect_get_times(void);
+
+#endif